@@ -0,0 +1,185 @@
+#include "../heap/gc.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+struct alignas(64) CacheLine
+{
+    std::uint64_t v[8];
+};
+
+// vector<int>: rast bafera kroz push_back
+template <typename Alloc>
+static std::uint64_t vector_workload(const Alloc &a, int rounds, int n)
+{
+    std::uint64_t sum = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        std::vector<int, Alloc> v(a);
+        for (int i = 0; i < n; i++)
+            v.push_back(i ^ r);
+        sum += (std::uint64_t)v[(std::size_t)n / 2];
+    }
+    return sum;
+}
+
+// unordered_map<int,int>: puno malih cvorova
+template <typename Alloc>
+static std::uint64_t map_workload(const Alloc &a, int rounds, int n)
+{
+    using Map = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Alloc>;
+    std::uint64_t sum = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        Map m(16, std::hash<int>(), std::equal_to<int>(), a);
+        for (int i = 0; i < n; i++)
+            m[i * 7 + r] = i;
+        for (int i = 0; i < n; i += 2)
+            m.erase(i * 7 + r);
+        sum += m.size();
+    }
+    return sum;
+}
+
+// vector<vector<int>>: rebind + propagacija heap-a
+template <typename Inner, typename Outer>
+static std::uint64_t nested_workload(const Outer &a, int rounds, int n)
+{
+    std::uint64_t sum = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        std::vector<Inner, Outer> outer(a);
+        for (int i = 0; i < n; i++)
+        {
+            outer.emplace_back(typename Inner::allocator_type(a));
+            for (int k = 0; k < 16; k++)
+                outer.back().push_back(k + i);
+        }
+        sum += outer.size();
+    }
+    return sum;
+}
+
+template <typename StdFn, typename GcFn>
+static void run(const char *name, StdFn std_fn, GcFn gc_fn, Heap *hf, Heap *hi)
+{
+    Clock::time_point t0 = Clock::now();
+    std::uint64_t s1 = std_fn();
+    double t_std = ms_since(t0);
+
+    t0 = Clock::now();
+    std::uint64_t s2 = gc_fn(hf);
+    double t_fl = ms_since(t0);
+    collect_heap(hf);
+
+    t0 = Clock::now();
+    std::uint64_t s3 = gc_fn(hi);
+    double t_ix = ms_since(t0);
+    collect_heap(hi);
+
+    assert(s1 == s2 && s1 == s3);
+    printf("%-24s std=%8.2f ms  free list=%8.2f ms (%.2fx)  immix=%8.2f ms (%.2fx)\n", name, t_std, t_fl,
+           t_fl / t_std, t_ix, t_ix / t_std);
+}
+
+// ns po operaciji: zakljucavanje i safepoint se vide tek na malim, cestim pozivima
+static void per_op(const char *name, Heap *h, Heap *hs)
+{
+    const int n = 2000000;
+    static void *slot;
+    Heap *heaps[2] = {h, hs};
+    double t[2][3];
+
+    for (int k = 0; k < 2; k++)
+    {
+        Clock::time_point t0 = Clock::now();
+        for (int i = 0; i < n; i++)
+            free_heap(heaps[k], alloc_heap(heaps[k], 32));
+        t[k][0] = ms_since(t0) * 1e6 / n;
+
+        t0 = Clock::now();
+        for (int i = 0; i < n; i++)
+        {
+            roots_add(heaps[k], &slot);
+            roots_remove(heaps[k], &slot);
+        }
+        t[k][1] = ms_since(t0) * 1e6 / n;
+
+        t0 = Clock::now();
+        for (int i = 0; i < n; i++)
+            gc_safepoint(heaps[k]);
+        t[k][2] = ms_since(t0) * 1e6 / n;
+    }
+
+    printf("%-24s alloc+free %6.1f -> %6.1f ns  roots add+remove %6.1f -> %6.1f ns  safepoint %5.1f -> %5.1f ns\n",
+           name, t[0][0], t[1][0], t[0][1], t[1][1], t[0][2], t[1][2]);
+}
+
+int main()
+{
+    printf("============ BENCH: gc_allocator vs std::allocator ============\n");
+
+    // isti radni tok na oba alokatora heap-a
+    HeapConfig cfg = {};
+    cfg.segment_size_bytes = 4 * 1024 * 1024;
+    Heap *hf = create_heap_ex(&cfg);
+    cfg.engine = HEAP_ENGINE_IMMIX;
+    Heap *hi = create_heap_ex(&cfg);
+    assert(hf != nullptr && hi != nullptr);
+    assert(thread_register(hf) == 0);
+    assert(thread_register(hi) == 0);
+
+    {
+        gc::gc_allocator<int> ga(hf);
+        std::vector<CacheLine, gc::gc_allocator<CacheLine>> lines(ga);
+        for (int i = 0; i < 100; i++)
+            lines.push_back(CacheLine());
+        assert(((std::uintptr_t)lines.data() & 63) == 0);
+        printf("[OK] over-aligned element type (alignas 64)\n");
+    }
+
+    std::allocator<int> sa;
+    run("vector<int> push_back", [&] { return vector_workload(sa, 50, 200000); },
+        [&](Heap *h) { return vector_workload(gc::gc_allocator<int>(h), 50, 200000); }, hf, hi);
+
+    using GcPair = gc::gc_allocator<std::pair<const int, int>>;
+    using StdPair = std::allocator<std::pair<const int, int>>;
+    run("unordered_map<int,int>", [&] { return map_workload(StdPair(), 10, 50000); },
+        [&](Heap *h) { return map_workload(GcPair(h), 10, 50000); }, hf, hi);
+
+    using StdInner = std::vector<int>;
+    using GcInner = std::vector<int, gc::gc_allocator<int>>;
+    run("vector<vector<int>>",
+        [&] { return nested_workload<StdInner>(std::allocator<StdInner>(), 10, 20000); },
+        [&](Heap *h) { return nested_workload<GcInner>(gc::gc_allocator<GcInner>(h), 10, 20000); }, hf, hi);
+
+    // isti poziv na heap-u sa lock-om i na jednonitnom heap-u
+    cfg.engine = HEAP_ENGINE_FREELIST;
+    cfg.single_thread = 1;
+    Heap *hs = create_heap_ex(&cfg);
+    assert(hs != nullptr);
+    assert(thread_register(hs) == 0);
+    per_op("locked -> single thread", hf, hs);
+    assert(thread_unregister(hs) == 0);
+    destroy_heap(hs);
+
+    assert(thread_unregister(hi) == 0);
+    assert(thread_unregister(hf) == 0);
+    destroy_heap(hi);
+    destroy_heap(hf);
+
+    printf("================================================================\n");
+    return 0;
+}
@@ -1,9 +1,342 @@
+// ucontext (fiber u CASE 20) na macOS-u trazi _XOPEN_SOURCE; _DARWIN_C_SOURCE vraca ostatak API-ja
+#ifdef __APPLE__
+#define _XOPEN_SOURCE 700
+#define _DARWIN_C_SOURCE
+#endif
+
 #include "../heap/heap.h"
+#include "../heap/heap_trace.h"
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define REPLAY_NO_MAIN
+#include "replay.c"
+
+static void *g_framed = NULL;
+static void *g_framed_weak = NULL;
+
+static void *g_pool_keep = NULL;
+static void *g_pool_weak[3] = {NULL, NULL, NULL};
+
+static void *g_region_root = NULL;
+static void *g_region_weak[3] = {NULL, NULL, NULL};
+
+static void *g_trace_root = NULL;
+static void *g_trace_keep[8];
+static void *g_trace_weak[42]; // 0-31 objekti radne niti, 32-41 glavne
+static size_t g_trace_size[42];
+static void *g_image_roots[2] = {NULL, NULL};
+static void *g_image_weak = NULL;
+
+static void *g_immix_list = NULL;
+static void *g_immix_holder = NULL;
+static void *g_immix_weak = NULL;
+
+static void *g_range_weak[2] = {NULL, NULL};
+static Heap *g_fiber_heap = NULL;
+static ucontext_t g_native_ctx;
+static ucontext_t g_fiber_ctx;
+static void *g_fiber_weak = NULL;
+
+static void *g_st_weak = NULL;
+
+static void *g_final_keep = NULL;
+static atomic_int g_final_runs = 0;
+static atomic_int g_final_ok = 0;
+static Heap *g_final_heap = NULL;
+static atomic_int g_final_allocs = 0;
+static int g_chain_runs = 0;
+static int g_chain_spawn = 0;
+
+static atomic_int g_fwait_stop = 0;
+static atomic_int g_fwait_allocs = 0;
+static atomic_int g_fwait_runs = 0;
+
+static void *g_pressure_holder = NULL;
+static atomic_int g_pressure_calls = 0;
+static atomic_size_t g_pressure_size = 0;
+
+static Heap *g_spin_heap = NULL;
+static atomic_int g_spin_ready = 0;
+static atomic_int g_spin_stop = 0;
+static void *g_spin_weak = NULL;
+static atomic_int g_deep_ready = 0;
+static atomic_int g_deep_stop = 0;
+static void *g_deep_weak = NULL;
+static atomic_int g_masked_ready = 0;
+static atomic_int g_masked_stop = 0;
+static void *g_masked_weak = NULL;
+
+// racuna bez alokacija (bez safepoint-a); objekat zivi samo na njenom steku
+// ciklus sa fibera: objekat koji drzi samo okvir ispod prelaza mora da prezivi
+static void fiber_main(void)
+{
+    collect_heap(g_fiber_heap);
+    swapcontext(&g_fiber_ctx, &g_native_ctx);
+}
+
+static __attribute__((noinline)) void *fiber_switch(Heap *h)
+{
+    void *volatile keep = alloc_heap(h, 32);
+    g_fiber_weak = keep;
+    weak_add(h, &g_fiber_weak);
+
+    thread_enter_fiber(h);
+    swapcontext(&g_native_ctx, &g_fiber_ctx);
+    return keep;
+}
+
+static void *spin_worker(void *arg)
+{
+    (void)arg;
+    assert(thread_register(g_spin_heap) == 0);
+
+    void *volatile obj = alloc_heap(g_spin_heap, 48);
+    g_spin_weak = obj;
+    assert(weak_add(g_spin_heap, &g_spin_weak) == 0);
+    atomic_store(&g_spin_ready, 1);
+
+    unsigned long x = 0;
+    while (!atomic_load(&g_spin_stop))
+        x = x * 31 + 7;
+
+    assert(g_spin_weak == obj);
+    weak_remove(g_spin_heap, &g_spin_weak);
+    thread_unregister(g_spin_heap);
+    return (void *)x;
+}
+
+// 1000 okvira koji se ne menjaju dok nit vrti safepoint na dnu
+static __attribute__((noinline)) int deep_frames(int depth)
+{
+    volatile int pad[16];
+    pad[0] = depth;
+    if (depth == 0)
+    {
+        atomic_store(&g_deep_ready, 1);
+        while (!atomic_load(&g_deep_stop))
+            gc_safepoint(g_spin_heap);
+        return pad[0];
+    }
+    return deep_frames(depth - 1) + pad[0];
+}
+
+// objekat drzi samo najstariji okvir niti
+static void *deep_worker(void *arg)
+{
+    (void)arg;
+    assert(thread_register(g_spin_heap) == 0);
+
+    void *volatile obj = alloc_heap(g_spin_heap, 48);
+    g_deep_weak = obj;
+    assert(weak_add(g_spin_heap, &g_deep_weak) == 0);
+    deep_frames(1000);
+
+    assert(g_deep_weak == obj);
+    weak_remove(g_spin_heap, &g_deep_weak);
+    thread_unregister(g_spin_heap);
+    return NULL;
+}
+
+// dugo blokira u sistemskom pozivu
+static void *native_worker(void *arg)
+{
+    (void)arg;
+    assert(thread_register(g_spin_heap) == 0);
+    atomic_fetch_add(&g_spin_ready, 1);
+
+    thread_enter_native(g_spin_heap);
+    while (!atomic_load(&g_spin_stop))
+        usleep(1000);
+    thread_leave_native(g_spin_heap);
+
+    thread_unregister(g_spin_heap);
+    return NULL;
+}
+
+// registruje se pa blokira signal za zaustavljanje; sakupljac ne sme da je ceka zauvek
+static void *masked_worker(void *arg)
+{
+    (void)arg;
+    assert(thread_register(g_spin_heap) == 0);
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    atomic_store(&g_masked_ready, 1);
+
+    while (!atomic_load(&g_masked_stop))
+        ;
+
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    thread_unregister(g_spin_heap);
+    return NULL;
+}
+
+static void final_cb(void *obj)
+{
+    void **o = (void **)obj;
+    if (o[0] && *(int *)o[0] == 42)
+        atomic_fetch_add(&g_final_ok, 1);
+    atomic_fetch_add(&g_final_runs, 1);
+}
+
+static void fwait_cb(void *obj)
+{
+    (void)obj;
+    atomic_fetch_add(&g_fwait_runs, 1);
+}
+
+// registrovana nit stalno ceka finalizatore dok druga nit trazi cikluse
+static void *fwait_worker(void *arg)
+{
+    Heap *h = (Heap *)arg;
+    assert(thread_register(h) == 0);
+    while (!atomic_load(&g_fwait_stop))
+    {
+        assert(alloc_heap_finalizable(h, 32, fwait_cb) != NULL);
+        atomic_fetch_add(&g_fwait_allocs, 1);
+        heap_finalize_wait(h);
+    }
+    thread_unregister(h);
+    return NULL;
+}
+
+static void *fwait_collector(void *arg)
+{
+    Heap *h = (Heap *)arg;
+    for (int i = 0; i < 300; i++)
+        collect_heap(h);
+    atomic_store(&g_fwait_stop, 1);
+    return NULL;
+}
+
+// ocekivana reakcija na pritisak: oslobodi kes i trazi ciklus
+static void pressure_cb(Heap *h, size_t heap_bytes, void *ctx)
+{
+    (void)ctx;
+    atomic_store(&g_pressure_size, heap_bytes);
+    atomic_fetch_add(&g_pressure_calls, 1);
+    collect_heap(h);
+}
+
+// finalizator koji alocira preko meke granice, trazi ciklus i ceka finalizatore
+static void final_alloc_cb(void *obj)
+{
+    (void)obj;
+    if (alloc_heap(g_final_heap, 256 * 1024) != NULL)
+        atomic_fetch_add(&g_final_allocs, 1);
+    collect_heap(g_final_heap);
+    heap_finalize_wait(g_final_heap);
+}
+
+// jednonitni heap: fn pravi nov finalizabilni otpad i odmah trazi ciklus
+static void final_chain_cb(void *obj)
+{
+    (void)obj;
+    g_chain_runs++;
+    if (g_chain_spawn > 0)
+    {
+        g_chain_spawn--;
+        assert(alloc_heap_finalizable(g_final_heap, 32, final_chain_cb) != NULL);
+        collect_heap(g_final_heap);
+        heap_finalize_wait(g_final_heap);
+    }
+}
+
+// lista iz CASE 16: n cvorova {next, vrednost}, vrednosti od n-1 do 0
+static int image_list_ok(void **node, int n)
+{
+    for (int i = n - 1; i >= 0; i--)
+    {
+        if (!node || node[1] != (void *)(uintptr_t)i)
+        {
+            return 0;
+        }
+        node = (void **)node[0];
+    }
+    return node == NULL;
+}
+
+// broj dogadjaja po vrsti u tragu (counts[op])
+// druga nit u tragu: cuva svaki cetvrti objekat u root slotu, neparne oslobadja
+static void *trace_worker(void *arg)
+{
+    Heap *h = (Heap *)arg;
+    thread_register(h);
+    for (int i = 0; i < 32; i++)
+    {
+        g_trace_size[i] = 16 + (size_t)i * 4;
+        void *p = alloc_heap(h, g_trace_size[i]);
+        if (i % 2)
+        {
+            free_heap(h, p);
+            continue;
+        }
+        g_trace_weak[i] = p;
+        weak_add(h, &g_trace_weak[i]);
+        if (i % 4 == 0)
+        {
+            g_trace_keep[i / 4] = p;
+            roots_add(h, &g_trace_keep[i / 4]);
+        }
+    }
+    thread_unregister(h);
+    return NULL;
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+static int trace_count(const char *path, size_t counts[8])
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return -1;
+    }
+    unsigned char buf[4096];
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    if (len < 5 || memcmp(buf, HEAP_TRACE_MAGIC, 4) != 0 || buf[4] != HEAP_TRACE_VERSION)
+    {
+        return -1;
+    }
+
+    static const int fields[8] = {0, 3, 2, 1, 3, 2, 1, 2};
+    memset(counts, 0, 8 * sizeof(size_t));
+    for (size_t p = 5; p < len;)
+    {
+        unsigned char op = buf[p++];
+        if (op == 0 || op > TRACE_MOVE)
+        {
+            return -1;
+        }
+        counts[op]++;
+        for (int k = 0; k < fields[op]; k++)
+        {
+            while (p < len && (buf[p] & 0x80))
+            {
+                p++;
+            }
+            p++;
+        }
+    }
+    return 0;
+}
 
 int main(void)
 {
@@ -94,9 +427,955 @@ int main(void)
     assert(thread_unregister(h) == 0);
     printf("[OK] thread_unregister\n");
 
+
+    printf("\n[CASE 5] weak references + ephemeron table\n");
+
+    void *w = alloc_heap(h, 48);
+    assert(w != NULL);
+    assert(weak_add(h, &w) == 0);
+
+    void *key = alloc_heap(h, 16);
+    void *val = alloc_heap(h, 64);
+    assert(key != NULL && val != NULL);
+    memset(val, 0x5A, 64);
+
+    EphemeronTable *et = ephemeron_create(h);
+    assert(et != NULL);
+    assert(ephemeron_put(et, key, val) == 0);
+    assert(roots_add(h, &key) == 0);
+    val = NULL;
+
+    collect_heap(h);
+    assert(w == NULL);
+    printf("[OK] weak slot cleared after GC\n");
+
+    unsigned char *uv = (unsigned char *)ephemeron_get(et, key);
+    assert(uv != NULL);
+    for (int i = 0; i < 64; i++)
+        assert(uv[i] == 0x5A);
+    uv = NULL;
+    printf("[OK] ephemeron value kept alive by key\n");
+
+    assert(roots_remove(h, &key) == 0);
+    key = NULL;
+    collect_heap(h);
+    assert(ephemeron_count(et) == 0);
+    printf("[OK] ephemeron entry dropped with key\n");
+
+    assert(weak_remove(h, &w) == 0);
+    ephemeron_destroy(et);
+
+
+    printf("\n[CASE 6] batch alloc + batch free\n");
+
+    void *batch[100];
+    assert(alloc_heap_batch(h, 24, 100, batch) == 100);
+    for (int i = 0; i < 100; i++)
+    {
+        assert(batch[i] != NULL);
+        memset(batch[i], i, 24);
+    }
+    // razliciti blokovi koji se ne preklapaju: svaki zadrzava svoj uzorak
+    void *sorted[100];
+    memcpy(sorted, batch, sizeof(sorted));
+    qsort(sorted, 100, sizeof(void *), ptr_cmp);
+    for (int i = 1; i < 100; i++)
+        assert((char *)sorted[i - 1] + 24 <= (char *)sorted[i]);
+    for (int i = 0; i < 100; i++)
+        for (int k = 0; k < 24; k++)
+            assert(((unsigned char *)batch[i])[k] == (unsigned char)i);
+    printf("[OK] alloc_heap_batch n=100: distinct, non-overlapping blocks\n");
+
+    size_t batch_heap = heap_size_bytes(h);
+    free_heap_batch(h, batch, 100);
+    void *again_batch[100];
+    assert(alloc_heap_batch(h, 24, 100, again_batch) == 100);
+    assert(heap_size_bytes(h) == batch_heap);
+    for (int i = 0; i < 100; i++)
+        assert(bsearch(&again_batch[i], sorted, 100, sizeof(void *), ptr_cmp) != NULL);
+    free_heap_batch(h, again_batch, 100);
+    printf("[OK] free_heap_batch n=100: the next batch reuses the same blocks\n");
+
+
+    printf("\n[CASE 7] hashed roots + root frames\n");
+
+    void *many[1000];
+    assert(alloc_heap_batch(h, 16, 1000, many) == 1000);
+    for (int i = 0; i < 1000; i++)
+        assert(roots_add(h, &many[i]) == 0);
+    assert(roots_add(h, &many[10]) == 0);
+    for (int i = 0; i < 1000; i++)
+        assert(roots_remove(h, &many[i]) == 0);
+    assert(roots_remove(h, &many[10]) == -1);
+    printf("[OK] roots_add/roots_remove x1000\n");
+
+    assert(roots_pop_frame(h) == -1);
+    assert(thread_register(h) == 0);
+
+    g_framed = alloc_heap(h, 40);
+    g_framed_weak = g_framed;
+    assert(weak_add(h, &g_framed_weak) == 0);
+
+    void **frame[] = { &g_framed };
+    assert(roots_push_frame(h, frame, 1) == 0);
+    collect_heap(h);
+    assert(g_framed_weak != NULL);
+    printf("[OK] frame keeps object alive\n");
+
+    assert(roots_pop_frame(h) == 0);
+    assert(roots_pop_frame(h) == -1);
+    assert(weak_remove(h, &g_framed_weak) == 0);
+    g_framed = NULL;
+    g_framed_weak = NULL;
+    assert(thread_unregister(h) == 0);
+    printf("[OK] roots_pop_frame\n");
+
+
+    printf("\n[CASE 8] zeroing: reused blocks are cleared, uninit skips it\n");
+
+    unsigned char *z = (unsigned char *)alloc_heap(h, 256);
+    assert(z != NULL);
+    memset(z, 0xEE, 256);
+    free_heap(h, z);
+
+    z = (unsigned char *)alloc_heap(h, 256);
+    assert(z != NULL);
+    for (int i = 0; i < 256; i++)
+        assert(z[i] == 0);
+    printf("[OK] alloc_heap returns zeroed memory after reuse\n");
+
+    unsigned char *u = (unsigned char *)alloc_heap_uninit(h, 4096);
+    assert(u != NULL);
+    memset(u, 0x42, 4096);
+    free_heap(h, u);
+    free_heap(h, z);
+    printf("[OK] alloc_heap_uninit\n");
+
+
+    printf("\n[CASE 10] alloc_heap_aligned\n");
+
+    size_t aligns[] = { 16, 64, 4096 };
+    for (int i = 0; i < 3; i++)
+    {
+        void *al = alloc_heap_aligned(h, 100, aligns[i]);
+        assert(al != NULL);
+        assert(((uintptr_t)al & (aligns[i] - 1)) == 0);
+        memset(al, 0x77, 100);
+        free_heap(h, al);
+    }
+    assert(alloc_heap_aligned(h, 100, 48) == NULL);
+    printf("[OK] 16/64/4096-byte alignment\n");
+
+
+    printf("\n[CASE 11] async collection on the collector thread\n");
+
+    GcTicket t1 = collect_heap_async(h);
+    GcTicket t2 = collect_heap_async(h);
+    assert(t1 != 0 && t2 >= t1);
+    collect_heap_wait(h, t2);
+    assert(collect_heap_done(h, t1) && collect_heap_done(h, t2));
+    printf("[OK] collect_heap_async + collect_heap_wait\n");
+
+
+    printf("\n[CASE 12] collection with a spinning thread and a thread in native code\n");
+
+    g_spin_heap = h;
+    pthread_t spin, native;
+    assert(pthread_create(&spin, NULL, spin_worker, NULL) == 0);
+    while (atomic_load(&g_spin_ready) != 1)
+        ;
+    assert(pthread_create(&native, NULL, native_worker, NULL) == 0);
+    while (atomic_load(&g_spin_ready) != 2)
+        ;
+
+    for (int i = 0; i < 5; i++)
+        collect_heap(h);
+    assert(g_spin_weak != NULL);
+    printf("[OK] spinning thread suspended, its stack scanned\n");
+
+    atomic_store(&g_spin_stop, 1);
+    pthread_join(spin, NULL);
+    pthread_join(native, NULL);
+    printf("[OK] native thread did not block collection\n");
+
+    pthread_t deep;
+    assert(pthread_create(&deep, NULL, deep_worker, NULL) == 0);
+    while (!atomic_load(&g_deep_ready))
+        ;
+    for (int i = 0; i < 5; i++)
+        collect_heap(h);
+    assert(g_deep_weak != NULL);
+    atomic_store(&g_deep_stop, 1);
+    pthread_join(deep, NULL);
+    printf("[OK] root in a frame 1000 calls deep survives repeated cycles\n");
+
+    sigset_t usr2;
+    sigset_t old_mask;
+    sigemptyset(&usr2);
+    sigaddset(&usr2, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &usr2, &old_mask);
+    assert(thread_register(h) == -1);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    printf("[OK] thread with the suspend signal blocked cannot register\n");
+
+    g_masked_weak = alloc_heap(h, 32);
+    assert(weak_add(h, &g_masked_weak) == 0);
+    pthread_t masked;
+    assert(pthread_create(&masked, NULL, masked_worker, NULL) == 0);
+    while (!atomic_load(&g_masked_ready))
+        ;
+    collect_heap(h);
+    assert(g_masked_weak != NULL);
+    atomic_store(&g_masked_stop, 1);
+    pthread_join(masked, NULL);
+    collect_heap(h);
+    assert(g_masked_weak == NULL);
+    weak_remove(h, &g_masked_weak);
+    printf("[OK] cycle that cannot stop a thread is skipped, not hung\n");
+
+
+    printf("\n[CASE 13] fixed-size pools (slabs)\n");
+
+    HeapPool *pool = heap_pool_create(h, 24);
+    assert(pool != NULL);
+    assert(heap_pool_create(h, 0) == NULL);
+
+    void *objs[5000];
+    for (int i = 0; i < 5000; i++)
+    {
+        objs[i] = heap_pool_alloc(pool);
+        assert(objs[i] != NULL);
+        assert(((uintptr_t)objs[i] & 7) == 0);
+        assert(((unsigned char *)objs[i])[0] == 0 && ((unsigned char *)objs[i])[23] == 0);
+        memset(objs[i], 0xAB, 24);
+        if (i > 0)
+            assert(objs[i] != objs[i - 1]);
+    }
+    printf("[OK] 5000 objects across several slabs\n");
+
+    heap_pool_free(pool, objs[10]);
+    void *again = heap_pool_alloc(pool);
+    assert(again == objs[10]);
+    assert(((unsigned char *)again)[5] == 0);
+    free_heap(h, again);
+    assert(heap_pool_alloc(pool) == objs[10]);
+    printf("[OK] heap_pool_free / free_heap reuse the slot\n");
+
+    // keep -> pool objekat -> obican blok; ostalo je smece
+    void **keep = (void **)heap_pool_alloc(pool);
+    void *tail = alloc_heap(h, 100);
+    keep[0] = tail;
+    g_pool_keep = keep;
+    assert(roots_add(h, &g_pool_keep) == 0);
+
+    g_pool_weak[0] = keep;
+    g_pool_weak[1] = tail;
+    g_pool_weak[2] = heap_pool_alloc(pool);
+    for (int i = 0; i < 3; i++)
+        assert(weak_add(h, &g_pool_weak[i]) == 0);
+    memset(objs, 0, sizeof(objs));
+    again = NULL;
+    keep = NULL;
+    tail = NULL;
+
+    collect_heap(h);
+    assert(g_pool_weak[0] == g_pool_keep);
+    assert(g_pool_weak[1] != NULL && ((void **)g_pool_keep)[0] == g_pool_weak[1]);
+    assert(g_pool_weak[2] == NULL);
+    printf("[OK] pool objects traced and swept by collect_heap\n");
+
+    for (int i = 0; i < 3; i++)
+        weak_remove(h, &g_pool_weak[i]);
+    roots_remove(h, &g_pool_keep);
+    heap_pool_destroy(pool);
+    printf("[OK] heap_pool_destroy\n");
+
+
+    printf("\n[CASE 14] request-scoped regions\n");
+
+    HeapRegion *rg = heap_region_begin(h);
+    assert(rg != NULL);
+    void **first = (void **)heap_region_alloc(rg, 40);
+    void **prev = first;
+    for (int i = 0; i < 3000; i++)
+    {
+        void **o = (void **)heap_region_alloc(rg, 40);
+        assert(o != NULL && o[0] == NULL);
+        prev[0] = o;
+        prev = o;
+    }
+    prev[0] = alloc_heap(h, 64);
+    g_region_weak[0] = prev[0];
+    assert(weak_add(h, &g_region_weak[0]) == 0);
+    // veci od chunka: blok segmenta; slaba referenca bi bila beg, pa se proverava sadrzaj
+    unsigned char *big_obj = (unsigned char *)heap_region_alloc(rg, 200 * 1024);
+    assert(big_obj != NULL);
+    memset(big_obj, 0x77, 200 * 1024);
+    prev = NULL;
+
+    collect_heap(h);
+    assert(g_region_weak[0] != NULL);
+    void *big_probe = alloc_heap(h, 200 * 1024);
+    assert(big_probe != big_obj && big_obj[200 * 1024 - 1] == 0x77);
+    free_heap(h, big_probe);
+    printf("[OK] region objects act as roots while the region is open\n");
+
+    heap_region_end(rg);
+    assert(alloc_heap(h, 200 * 1024) == (void *)big_obj);
+    big_obj = NULL;
+    rg = heap_region_begin(h);
+    assert(heap_region_alloc(rg, 40) == (void *)first);
+    heap_region_end(rg);
+    printf("[OK] heap_region_end recycles chunks and large objects without a collection\n");
+
+    collect_heap(h);
+    assert(g_region_weak[0] == NULL);
+
+    assert(roots_add(h, &g_region_root) == 0);
+    rg = heap_region_begin(h);
+    void **esc = (void **)heap_region_alloc(rg, 32);
+    esc[1] = (void *)0x5a5a;
+    heap_store(h, &g_region_root, esc);
+    heap_region_end(rg);
+    esc = NULL;
+
+    collect_heap(h);
+    assert(((void **)g_region_root)[1] == (void *)0x5a5a);
+    printf("[OK] escaped region is promoted to the heap\n");
+
+    g_region_weak[1] = g_region_root;
+    assert(weak_add(h, &g_region_weak[1]) == 0);
+    roots_remove(h, &g_region_root);
+    g_region_root = NULL;
+    collect_heap(h);
+    assert(g_region_weak[1] == NULL);
+    printf("[OK] promoted objects are collected once unreachable\n");
+
+    // veliki objekat je jedino sto bezi iz regiona
+    assert(roots_add(h, &g_region_root) == 0);
+    rg = heap_region_begin(h);
+    unsigned char *esc_big = (unsigned char *)heap_region_alloc(rg, 200 * 1024);
+    memset(esc_big, 0x77, 200 * 1024);
+    heap_store(h, &g_region_root, esc_big);
+    heap_region_end(rg);
+    g_region_weak[2] = esc_big;
+    assert(weak_add(h, &g_region_weak[2]) == 0);
+    esc_big = NULL;
+    collect_heap(h);
+    assert(g_region_weak[2] == g_region_root && ((unsigned char *)g_region_root)[200 * 1024 - 1] == 0x77);
+    roots_remove(h, &g_region_root);
+    g_region_root = NULL;
+    collect_heap(h);
+    assert(g_region_weak[2] == NULL);
+    weak_remove(h, &g_region_weak[0]);
+    weak_remove(h, &g_region_weak[1]);
+    weak_remove(h, &g_region_weak[2]);
+    printf("[OK] large region objects: kept while open, freed or promoted at the end\n");
+
+
+    printf("\n[CASE 15] allocation trace\n");
+
+    const char *trace_path = "/tmp/heap_case15.htrc";
+    assert(heap_trace_start(h, trace_path) == 0);
+    assert(heap_trace_start(h, trace_path) == -1);
+
+    void *tr[10];
+    for (int i = 0; i < 10; i++)
+    {
+        tr[i] = alloc_heap(h, 24 + (size_t)i * 8);
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        free_heap(h, tr[i]);
+    }
+    for (int i = 5; i < 10; i++)
+    {
+        g_trace_weak[27 + i] = tr[i];
+        g_trace_size[27 + i] = 24 + (size_t)i * 8;
+        assert(weak_add(h, &g_trace_weak[27 + i]) == 0);
+    }
+    g_trace_root = tr[5];
+    assert(roots_add(h, &g_trace_root) == 0);
+
+    pthread_t trace_thread;
+    assert(pthread_create(&trace_thread, NULL, trace_worker, h) == 0);
+    pthread_join(trace_thread, NULL);
+
+    collect_heap(h);
+    roots_remove(h, &g_trace_root);
+    g_trace_root = NULL;
+
+    assert(heap_trace_stop(h) == 0);
+    assert(heap_trace_stop(h) == -1);
+
+    size_t counts[8];
+    assert(trace_count(trace_path, counts) == 0);
+    assert(counts[TRACE_ALLOC] == 42 && counts[TRACE_FREE] == 21);
+    assert(counts[TRACE_ROOT_ADD] == 9 && counts[TRACE_ROOT_DEL] == 1);
+    assert(counts[TRACE_COLLECT] == 1);
+    printf("[OK] alloc/free/root/collect events recorded (%zu swept)\n", counts[TRACE_GC_FREE]);
+
+    // posle ciklusa iz traga zivi su tacno objekti sa neobrisanom weak referencom
+    size_t trace_live = 0;
+    size_t trace_bytes = 0;
+    for (int i = 0; i < 42; i++)
+    {
+        if (g_trace_weak[i])
+        {
+            trace_live++;
+            trace_bytes += g_trace_size[i];
+            weak_remove(h, &g_trace_weak[i]);
+            g_trace_weak[i] = NULL;
+        }
+    }
+    assert(trace_live >= 9);
+
+    // replay istog traga: serijski, Immix i po nitima iz traga
+    const int replay_engine[3] = {HEAP_ENGINE_FREELIST, HEAP_ENGINE_IMMIX, HEAP_ENGINE_FREELIST};
+    for (int k = 0; k < 3; k++)
+    {
+        ReplayResult res;
+        assert(replay_trace(trace_path, k == 2, replay_engine[k], 1024 * 1024, &res) == 0);
+        assert(res.allocs == 42 && res.frees == 21 && res.failed == 0);
+        assert(res.threads == 2 && res.collections == 1);
+        assert(res.live == trace_live && res.live_bytes == trace_bytes);
+        assert(res.damaged == 0);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        roots_remove(h, &g_trace_keep[i]);
+        g_trace_keep[i] = NULL;
+    }
+    unlink(trace_path);
+    printf("[OK] replay (serial, immix, threaded): %zu live objects, %zu bytes, as recorded\n", trace_live,
+           trace_bytes);
+
+
+    printf("\n[CASE 16] heap image save/load\n");
+
+    const char *image_path = "/tmp/heap_case16.img";
+    assert(roots_add(h, &g_image_roots[0]) == 0);
+    assert(roots_add(h, &g_image_roots[1]) == 0);
+    for (int i = 0; i < 1000; i++)
+    {
+        void **node = (void **)alloc_heap(h, 2 * sizeof(void *));
+        node[0] = g_image_roots[0];
+        node[1] = (void *)(uintptr_t)i;
+        g_image_roots[0] = node;
+    }
+    g_image_roots[1] = alloc_heap_uninit(h, 32);
+    strcpy((char *)g_image_roots[1], "immutable lookup table");
+
+    assert(heap_save(h, image_path, g_image_roots, 2) == 0);
+    void *saved_list = g_image_roots[0];
+    roots_remove(h, &g_image_roots[0]);
+    roots_remove(h, &g_image_roots[1]);
+
+    HeapConfig icfg = {0};
+    icfg.segment_size_bytes = 1024 * 1024;
+    icfg.reserve_bytes = 64 * 1024 * 1024;
+
+    // izvorni heap je jos ziv, pa slika ne moze na staru adresu
+    void *loaded[2];
+    Heap *hi = heap_load(image_path, &icfg, loaded, 2);
+    assert(hi != NULL && loaded[0] != saved_list);
+    assert(image_list_ok((void **)loaded[0], 1000));
+    assert(strcmp((const char *)loaded[1], "immutable lookup table") == 0);
+    printf("[OK] image loaded at a new address and relocated\n");
+
+    collect_heap(hi);
+    free_heap(hi, loaded[0]);
+    collect_heap(hi);
+    assert(image_list_ok((void **)loaded[0], 1000));
+    printf("[OK] image objects survive collection and free_heap\n");
+
+    void **img_node = (void **)loaded[0];
+    void *fresh = alloc_heap(hi, 48);
+    g_image_weak = fresh;
+    assert(weak_add(hi, &g_image_weak) == 0);
+    heap_store(hi, &img_node[1], fresh);
+    fresh = NULL;
+    collect_heap(hi);
+    assert(g_image_weak != NULL);
+    heap_store(hi, &img_node[1], (void *)(uintptr_t)999);
+    collect_heap(hi);
+    assert(g_image_weak == NULL);
+    weak_remove(hi, &g_image_weak);
+    printf("[OK] heap_store into the image keeps new objects alive\n");
+
+    // NOSCAN podatak u slici lici na adresu iz heap-a; ponovno snimanje ga ne relocira
+    const char *image2_path = "/tmp/heap_case16b.img";
+    uintptr_t fake = (uintptr_t)loaded[0];
+    memcpy((char *)loaded[1] + 24, &fake, sizeof(fake));
+    assert(heap_save(hi, image2_path, loaded, 2) == 0);
+    void *loaded2[2];
+    Heap *hi2 = heap_load(image2_path, &icfg, loaded2, 2);
+    assert(hi2 != NULL && loaded2[0] != loaded[0]);
+    assert(image_list_ok((void **)loaded2[0], 1000));
+    uintptr_t fake2;
+    memcpy(&fake2, (char *)loaded2[1] + 24, sizeof(fake2));
+    assert(fake2 == fake && strcmp((const char *)loaded2[1], "immutable lookup table") == 0);
+    destroy_heap(hi2);
+    unlink(image2_path);
+    printf("[OK] re-saved image relocates pointers only, NOSCAN data intact\n");
+
+    // zaglavlje sa n_roots + n_relocs koje se prelije (x8 daje 0) ne sme da prodje
+    uint64_t bad_hdr[7];
+    FILE *src = fopen(image_path, "rb");
+    assert(src != NULL && fread(bad_hdr, sizeof(bad_hdr), 1, src) == 1);
+    assert(fseek(src, 0, SEEK_END) == 0);
+    long image_size = ftell(src);
+    fclose(src);
+    bad_hdr[4] = (uint64_t)1 << 61;
+    bad_hdr[5] = (uint64_t)1 << 63;
+    const char *image3_path = "/tmp/heap_case16c.img";
+    FILE *dst = fopen(image3_path, "wb");
+    assert(dst != NULL && fwrite(bad_hdr, sizeof(bad_hdr), 1, dst) == 1);
+    assert(fflush(dst) == 0 && ftruncate(fileno(dst), image_size) == 0);
+    fclose(dst);
+    assert(heap_load(image3_path, &icfg, loaded2, 2) == NULL);
+    unlink(image3_path);
+    printf("[OK] image header with overflowing table size rejected\n");
+    destroy_heap(hi);
+
     destroy_heap(h);
     printf("\n[OK] destroy_heap\n");
 
+    hi = heap_load(image_path, &icfg, loaded, 2);
+    assert(hi != NULL && image_list_ok((void **)loaded[0], 1000));
+    if (loaded[0] == saved_list)
+        printf("[OK] image mapped back at its saved address (no relocation)\n");
+    else
+        printf("[INFO] saved address was taken, image relocated\n");
+    destroy_heap(hi);
+    unlink(image_path);
+
+
+    printf("\n[CASE 17] realloc_heap\n");
+
+    Heap *hr = create_heap(1024 * 1024, 64 * 1024 * 1024);
+    assert(hr != NULL);
+
+    unsigned char *rb = (unsigned char *)alloc_heap(hr, 64);
+    memset(rb, 0x5A, 64);
+    unsigned char *rb2 = (unsigned char *)realloc_heap(hr, rb, 4096);
+    assert(rb2 == rb);
+    for (int i = 0; i < 4096; i++)
+        assert(rb2[i] == (i < 64 ? 0x5A : 0));
+    printf("[OK] grows in place into the free neighbour\n");
+
+    rb2 = (unsigned char *)realloc_heap(hr, rb, 32);
+    assert(rb2 == rb && rb2[0] == 0x5A && rb2[31] == 0x5A);
+    void *after = alloc_heap(hr, 1024);
+    assert((unsigned char *)after > rb2 && (unsigned char *)after < rb2 + 4096);
+    printf("[OK] shrinking gives the tail back to the free list\n");
+
+    rb2 = (unsigned char *)realloc_heap(hr, rb, 8192);
+    assert(rb2 != NULL && rb2 != rb);
+    for (int i = 0; i < 32; i++)
+        assert(rb2[i] == 0x5A);
+    printf("[OK] moves and copies when the neighbour is taken\n");
+
+    HeapPool *rp = heap_pool_create(hr, 48);
+    void *po = heap_pool_alloc(rp);
+    assert(realloc_heap(hr, po, 40) == po);
+    static const size_t r_offs[] = { 0 };
+    HeapType r_type = { 16, 1, r_offs };
+    assert(realloc_heap(hr, alloc_heap_typed(hr, &r_type), 64) == NULL);
+    assert(realloc_heap(hr, NULL, 16) != NULL);
+    assert(realloc_heap(hr, rb2, 0) == NULL);
+    printf("[OK] pool objects, typed objects, NULL and size 0\n");
+
+    heap_pool_destroy(rp);
+    destroy_heap(hr);
+
+
+    printf("\n[CASE 18] Immix engine: line allocation + evacuation\n");
+
+    HeapConfig xcfg = {0};
+    xcfg.segment_size_bytes = 1024 * 1024;
+    xcfg.reserve_bytes = 64 * 1024 * 1024;
+    xcfg.engine = HEAP_ENGINE_IMMIX;
+    Heap *hx = create_heap_ex(&xcfg);
+    assert(hx != NULL);
+
+    // lista tipiziranih cvorova {next, i}; izmedju cvorova 15 objekata smeca
+    enum { X_NODES = 2000 };
+    static const size_t x_offs[] = { 0 };
+    HeapType x_type = { 2 * sizeof(void *), 1, x_offs };
+    void **x_addr = (void **)malloc(X_NODES * sizeof(void *));
+    assert(x_addr != NULL);
+    assert(roots_add(hx, &g_immix_list) == 0);
+    for (int i = 0; i < X_NODES; i++)
+    {
+        void **node = (void **)alloc_heap_typed(hx, &x_type);
+        assert(node != NULL);
+        node[0] = g_immix_list;
+        node[1] = (void *)(uintptr_t)i;
+        g_immix_list = node;
+        x_addr[i] = node;
+        for (int k = 0; k < 15; k++)
+            assert(alloc_heap(hx, 48) != NULL);
+    }
+
+    // cvor 500 drzi i obican (konzervativno skeniran) objekat, pa ne sme da se pomeri
+    g_immix_holder = alloc_heap(hx, 16);
+    ((void **)g_immix_holder)[0] = x_addr[500];
+    assert(roots_add(hx, &g_immix_holder) == 0);
+    g_immix_weak = x_addr[0];
+    assert(weak_add(hx, &g_immix_weak) == 0);
+
+    // prvi ciklus meri linije, drugi prazni retke blokove
+    collect_heap(hx);
+    collect_heap(hx);
+
+    int x_moved = 0;
+    void **x_node = (void **)g_immix_list;
+    void *x_tail = NULL;
+    for (int i = X_NODES - 1; i >= 0; i--)
+    {
+        assert(x_node != NULL && (uintptr_t)x_node[1] == (uintptr_t)i);
+        if ((void *)x_node != x_addr[i])
+            x_moved++;
+        if (i == 500)
+            assert((void *)x_node == x_addr[500]);
+        x_tail = x_node;
+        x_node = (void **)x_node[0];
+    }
+    assert(x_node == NULL);
+    assert(x_moved > 0);
+    assert(g_immix_weak == x_tail);
+    printf("[OK] %d of %d list nodes evacuated, list intact\n", x_moved, X_NODES);
+    printf("[OK] conservatively referenced node pinned, weak ref forwarded\n");
+
+    unsigned char *xb = (unsigned char *)alloc_heap(hx, 100);
+    for (int i = 0; i < 100; i++)
+        assert(xb[i] == 0);
+    free_heap(hx, xb);
+    assert(alloc_heap(hx, 64 * 1024) != NULL);
+    printf("[OK] recycled lines are zeroed, large objects go to segments\n");
+
+    weak_remove(hx, &g_immix_weak);
+    roots_remove(hx, &g_immix_holder);
+    roots_remove(hx, &g_immix_list);
+    free(x_addr);
+    destroy_heap(hx);
+
+
+    printf("\n[CASE 19] try_alloc_heap\n");
+
+    Heap *ht = create_heap(1024 * 1024, 64 * 1024 * 1024);
+    assert(ht != NULL);
+
+    unsigned char *tb = (unsigned char *)try_alloc_heap(ht, 200, 0);
+    assert(tb != NULL && tb[0] == 0 && tb[199] == 0);
+    assert(try_alloc_heap(ht, 200, HEAP_ALLOC_UNINIT) != NULL);
+    printf("[OK] small requests served from the free list\n");
+
+    // veci od svakog slobodnog bloka: NULL odmah, heap ne raste
+    assert(try_alloc_heap(ht, 4 * 1024 * 1024, 0) == NULL);
+    collect_heap(ht);
+    assert(try_alloc_heap(ht, 4 * 1024 * 1024, 0) != NULL);
+    printf("[OK] miss returns NULL, collector refills after the cycle\n");
+    destroy_heap(ht);
+
+    xcfg.engine = HEAP_ENGINE_IMMIX;
+    Heap *htx = create_heap_ex(&xcfg);
+    assert(htx != NULL);
+    assert(try_alloc_heap(htx, 64, 0) == NULL);
+    collect_heap(htx);
+    assert(try_alloc_heap(htx, 64, 0) != NULL);
+    printf("[OK] Immix: no block yet -> NULL, refill adds one\n");
+    destroy_heap(htx);
+
+
+    printf("\n[CASE 20] scan ranges (fiber stacks, pointer arrays)\n");
+
+    Heap *hs = create_heap(1024 * 1024, 64 * 1024 * 1024);
+    assert(hs != NULL);
+
+    // "stek fibera": raste nadole, sacuvani sp je na reci 64
+    void **fstack = (void **)calloc(128, sizeof(void *));
+    assert(fstack != NULL);
+    fstack[100] = alloc_heap(hs, 32);
+    fstack[10] = alloc_heap(hs, 32);
+    g_range_weak[0] = fstack[100];
+    g_range_weak[1] = fstack[10];
+    assert(weak_add(hs, &g_range_weak[0]) == 0);
+    assert(weak_add(hs, &g_range_weak[1]) == 0);
+
+    HeapScanRange *sr = heap_add_scan_range(hs, fstack, fstack + 128);
+    assert(sr != NULL);
+    heap_scan_range_set(sr, &fstack[64]);
+    collect_heap(hs);
+    assert(g_range_weak[0] != NULL && g_range_weak[1] == NULL);
+    printf("[OK] range scanned from the saved sp up\n");
+
+    heap_scan_range_set(sr, NULL);
+    collect_heap(hs);
+    assert(g_range_weak[0] == NULL);
+    printf("[OK] switched-off range keeps nothing alive\n");
+
+    assert(heap_remove_scan_range(hs, sr) == 0);
+    weak_remove(hs, &g_range_weak[0]);
+    weak_remove(hs, &g_range_weak[1]);
+    free(fstack);
+
+    // registrovana nit sakuplja dok radi na fiberu
+    size_t fiber_size = 256 * 1024;
+    void *fiber_stack = malloc(fiber_size);
+    assert(fiber_stack != NULL);
+    HeapScanRange *fr = heap_add_scan_range(hs, fiber_stack, (char *)fiber_stack + fiber_size);
+    assert(fr != NULL);
+    assert(getcontext(&g_fiber_ctx) == 0);
+    g_fiber_ctx.uc_stack.ss_sp = fiber_stack;
+    g_fiber_ctx.uc_stack.ss_size = fiber_size;
+    g_fiber_ctx.uc_link = NULL;
+    makecontext(&g_fiber_ctx, fiber_main, 0);
+
+    g_fiber_heap = hs;
+    assert(thread_register(hs) == 0);
+    void *fiber_kept = fiber_switch(hs);
+    assert(g_fiber_weak == fiber_kept);
+    assert(thread_unregister(hs) == 0);
+    weak_remove(hs, &g_fiber_weak);
+    assert(heap_remove_scan_range(hs, fr) == 0);
+    free(fiber_stack);
+    printf("[OK] thread's own stack scanned from where it switched to the fiber\n");
+    destroy_heap(hs);
+
+
+    printf("\n[CASE 21] single-threaded heap\n");
+
+    HeapConfig scfg = {0};
+    scfg.segment_size_bytes = 1024 * 1024;
+    scfg.single_thread = 1;
+    Heap *hst = create_heap_ex(&scfg);
+    assert(hst != NULL);
+    assert(thread_register(hst) == 0);
+
+    void *volatile st_keep = alloc_heap(hst, 64);
+    g_st_weak = st_keep;
+    assert(weak_add(hst, &g_st_weak) == 0);
+    GcTicket st_ticket = collect_heap_async(hst);
+    assert(collect_heap_done(hst, st_ticket));
+    assert(g_st_weak == st_keep);
+    printf("[OK] collection runs inline and scans the caller's stack\n");
+
+    gc_safepoint(hst);
+    thread_enter_native(hst);
+    thread_leave_native(hst);
+    void *st_big = try_alloc_heap(hst, 4 * 1024 * 1024, 0);
+    assert(st_big == NULL);
+    collect_heap(hst);
+    assert(try_alloc_heap(hst, 4 * 1024 * 1024, 0) != NULL);
+    printf("[OK] safepoints are no-ops, try_alloc miss refilled by collect_heap\n");
+
+    weak_remove(hst, &g_st_weak);
+    assert(thread_unregister(hst) == 0);
+    destroy_heap(hst);
+
+
+    printf("\n[CASE 22] finalizable objects\n");
+
+    Heap *hfz = create_heap(1024 * 1024, 64 * 1024 * 1024);
+    assert(hfz != NULL);
+
+    // {dete}; dete je obican objekat sa 42, finalizator ga cita
+    for (int i = 0; i < 10; i++)
+    {
+        void **fo = (void **)alloc_heap_finalizable(hfz, 2 * sizeof(void *), final_cb);
+        assert(fo != NULL);
+        fo[0] = alloc_heap(hfz, sizeof(int));
+        *(int *)fo[0] = 42;
+        if (i == 3)
+            g_final_keep = fo;
+    }
+    assert(roots_add(hfz, &g_final_keep) == 0);
+    assert(realloc_heap(hfz, g_final_keep, 64) == NULL);
+
+    collect_heap(hfz);
+    heap_finalize_wait(hfz);
+    assert(atomic_load(&g_final_runs) == 9 && atomic_load(&g_final_ok) == 9);
+    printf("[OK] 9 unreachable objects finalized, referents still intact\n");
+
+    collect_heap(hfz);
+    heap_finalize_wait(hfz);
+    assert(atomic_load(&g_final_runs) == 9);
+    roots_remove(hfz, &g_final_keep);
+    free_heap(hfz, g_final_keep);
+    g_final_keep = NULL;
+    collect_heap(hfz);
+    heap_finalize_wait(hfz);
+    assert(atomic_load(&g_final_runs) == 9);
+    printf("[OK] finalizer runs once; free_heap cancels it\n");
+
+    destroy_heap(hfz);
+
+    HeapConfig fcfg = {0};
+    fcfg.segment_size_bytes = 1024 * 1024;
+    fcfg.soft_limit_bytes = 2 * 1024 * 1024;
+    g_final_heap = create_heap_ex(&fcfg);
+    assert(g_final_heap != NULL);
+    for (int i = 0; i < 8; i++)
+        assert(alloc_heap_finalizable(g_final_heap, 32, final_alloc_cb) != NULL);
+    collect_heap(g_final_heap);
+    destroy_heap(g_final_heap);
+    g_final_heap = NULL;
+    assert(atomic_load(&g_final_allocs) == 8);
+    printf("[OK] destroy_heap drains finalizers that allocate and collect\n");
+
+    fcfg.soft_limit_bytes = 0;
+    fcfg.single_thread = 1;
+    g_final_heap = create_heap_ex(&fcfg);
+    assert(g_final_heap != NULL);
+    for (int i = 0; i < 4; i++)
+        assert(alloc_heap_finalizable(g_final_heap, 32, final_chain_cb) != NULL);
+    g_chain_spawn = 4;
+    collect_heap(g_final_heap);
+    assert(g_chain_runs == 8);
+    destroy_heap(g_final_heap);
+    g_final_heap = NULL;
+    printf("[OK] single-threaded: nested collect_heap in a finalizer keeps the batch\n");
+
+    Heap *hfw = create_heap(1024 * 1024, 64 * 1024 * 1024);
+    assert(hfw != NULL);
+    pthread_t fw_waiter, fw_collector;
+    assert(pthread_create(&fw_waiter, NULL, fwait_worker, hfw) == 0);
+    assert(pthread_create(&fw_collector, NULL, fwait_collector, hfw) == 0);
+    pthread_join(fw_waiter, NULL);
+    pthread_join(fw_collector, NULL);
+    collect_heap(hfw);
+    heap_finalize_wait(hfw);
+    assert(atomic_load(&g_fwait_runs) == atomic_load(&g_fwait_allocs));
+    destroy_heap(hfw);
+    printf("[OK] heap_finalize_wait in a loop while another thread collects\n");
+
+
+    printf("\n[CASE 23] soft/hard heap limit, pressure callbacks, heap_trim\n");
+
+    HeapConfig pcfg = {0};
+    pcfg.segment_size_bytes = 1024 * 1024;
+    pcfg.soft_limit_bytes = 4 * 1024 * 1024;
+    pcfg.hard_limit_bytes = 8 * 1024 * 1024;
+    Heap *hpr = create_heap_ex(&pcfg);
+    assert(hpr != NULL);
+    // GC sa prelaza meke granice je asinhron: nit mora biti registrovana
+    assert(thread_register(hpr) == 0);
+    assert(heap_add_pressure_callback(hpr, pressure_cb, NULL) == 0);
+
+    // {64 pokazivaca}; objekti od 256 KiB se pune da ne bi bili nule
+    g_pressure_holder = alloc_heap(hpr, 64 * sizeof(void *));
+    assert(g_pressure_holder != NULL);
+    assert(roots_add(hpr, &g_pressure_holder) == 0);
+    void **ph = (void **)g_pressure_holder;
+
+    for (int i = 0; i < 20; i++)
+    {
+        ph[i] = alloc_heap(hpr, 256 * 1024);
+        assert(ph[i] != NULL);
+        memset(ph[i], 0xAB, 256 * 1024);
+    }
+    // pozivi idu posle objave ciklusa; sledeci ciklus pocinje tek kad se zavrse
+    collect_heap(hpr);
+    collect_heap(hpr);
+    assert(atomic_load(&g_pressure_calls) == 1);
+    assert(atomic_load(&g_pressure_size) > pcfg.soft_limit_bytes);
+    printf("[OK] crossing the soft limit: GC + callback once (callback may collect)\n");
+
+    int filled = 20;
+    while (filled < 64)
+    {
+        void *o = alloc_heap(hpr, 256 * 1024);
+        if (!o)
+            break;
+        memset(o, 0xAB, 256 * 1024);
+        ph[filled++] = o;
+    }
+    assert(filled < 64);
+    assert(heap_size_bytes(hpr) <= pcfg.hard_limit_bytes);
+    collect_heap(hpr);
+    assert(atomic_load(&g_pressure_calls) == 1);
+    printf("[OK] hard limit: alloc returns NULL at %zu KiB, no second callback\n",
+           heap_size_bytes(hpr) / 1024);
+
+    memset(ph, 0, 64 * sizeof(void *));
+    collect_heap(hpr);
+    size_t before_trim = heap_size_bytes(hpr);
+    size_t trimmed = heap_trim(hpr);
+    assert(trimmed > 0);
+    assert(heap_size_bytes(hpr) == before_trim - trimmed);
+    assert(heap_size_bytes(hpr) < pcfg.soft_limit_bytes - pcfg.soft_limit_bytes / 8);
+    printf("[OK] heap_trim returned %zu KiB\n", trimmed / 1024);
+
+    // ispod 7/8 meke granice: pozivi ponovo vaze; trimovane stranice su nule
+    for (int i = 0; i < 20; i++)
+    {
+        unsigned char *o = (unsigned char *)alloc_heap(hpr, 256 * 1024);
+        assert(o != NULL);
+        for (size_t k = 0; k < 256 * 1024; k++)
+            assert(o[k] == 0);
+        ph[i] = o;
+    }
+    collect_heap(hpr);
+    collect_heap(hpr);
+    assert(atomic_load(&g_pressure_calls) == 2);
+    assert(heap_size_bytes(hpr) <= pcfg.hard_limit_bytes);
+    printf("[OK] reused trimmed blocks are zeroed, callback re-armed\n");
+
+    assert(heap_remove_pressure_callback(hpr, pressure_cb, NULL) == 0);
+    assert(heap_remove_pressure_callback(hpr, pressure_cb, NULL) == -1);
+    roots_remove(hpr, &g_pressure_holder);
+    assert(thread_unregister(hpr) == 0);
+    destroy_heap(hpr);
+
+    xcfg.engine = HEAP_ENGINE_IMMIX;
+    Heap *hpx = create_heap_ex(&xcfg);
+    assert(hpx != NULL);
+    for (int i = 0; i < 20000; i++)
+        assert(alloc_heap(hpx, 64) != NULL);
+    collect_heap(hpx);
+    size_t immix_before = heap_size_bytes(hpx);
+    assert(heap_trim(hpx) > 0);
+    assert(heap_size_bytes(hpx) < immix_before);
+    assert(alloc_heap(hpx, 64) != NULL);
+    printf("[OK] Immix: empty blocks returned to the OS\n");
+    destroy_heap(hpx);
+
+
+    printf("\n[CASE 9] create_heap_ex: reserved range + 2 MiB segments\n");
+
+    HeapConfig cfg = {0};
+    cfg.segment_size_bytes = 1024 * 1024;
+    cfg.reserve_bytes = 64 * 1024 * 1024;
+    cfg.huge_pages = 1;
+
+    Heap *hh = create_heap_ex(&cfg);
+    assert(hh != NULL);
+
+    void *big[40];
+    for (int i = 0; i < 40; i++)
+    {
+        big[i] = alloc_heap(hh, 256 * 1024);
+        assert(big[i] != NULL);
+        uintptr_t lo = (uintptr_t)big[i] < (uintptr_t)big[0] ? (uintptr_t)big[i] : (uintptr_t)big[0];
+        uintptr_t hi = (uintptr_t)big[i] < (uintptr_t)big[0] ? (uintptr_t)big[0] : (uintptr_t)big[i];
+        assert(hi - lo < cfg.reserve_bytes);
+    }
+    printf("[OK] 40 x 256 KiB inside one reservation\n");
+
+    HeapPool *hp = heap_pool_create(hh, 64);
+    for (int i = 0; i < 3000; i++)
+    {
+        void *o = heap_pool_alloc(hp);
+        assert(o != NULL && (uintptr_t)o - (uintptr_t)big[0] < cfg.reserve_bytes);
+    }
+    printf("[OK] pool slabs carved from a 2 MiB segment\n");
+
+    collect_heap(hh);
+    destroy_heap(hh);
+    printf("[OK] destroy_heap (huge pages)\n");
+
     
 
     printf("\nALL TESTS: PASS\n");
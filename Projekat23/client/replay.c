@@ -0,0 +1,745 @@
+#include "../heap/heap.h"
+#include "../heap/heap_trace.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// replay traga iz heap_trace_start nad novim heap-om
+//   replay <trag> [-t] [-i] [-s segment_bajtova]
+//   -t: svaka nit iz traga dobija svoju nit; GC_FREE/COLLECT izvrsava glavna nit
+//   -i: heap sa Immix alokatorom (HEAP_ENGINE_IMMIX)
+// na kraju ispisuje zive objekte posle jos jednog ciklusa; izlaz 1 ako je neki ostecen
+//
+// objekti nemaju pokazivace jedni na druge: zivost se prenosi tako sto se
+// objekat drzi u tabeli (rootovan blok heap-a) dok ga trag ne oslobodi
+
+#define NO_DEP UINT32_MAX
+
+typedef struct Event
+{
+    unsigned char op;
+    uint32_t tid;
+    uint32_t id;  // objekat (ALLOC/FREE/GC_FREE) ili slot (ROOT_*)
+    uint32_t val; // ROOT_ADD: objekat + 1, 0 ako slot ne pokazuje na objekat
+    uint32_t dep; // dogadjaj druge niti koji mora biti izvrsen pre ovog
+    uint64_t size;
+} Event;
+
+typedef struct Trace
+{
+    Event *ev;
+    size_t n;
+    size_t cap;
+
+    uint32_t objects; // najveci broj istovremeno zivih objekata
+    uint32_t slots;
+    uint32_t max_tid;
+} Trace;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// ------ MAPA adresa -> indeks (otvoreno adresiranje) -----------
+typedef struct MapEntry
+{
+    uint64_t key; // kljuc + 1; 0 prazno, UINT64_MAX obrisano
+    uint32_t id;
+    uint32_t event;
+} MapEntry;
+
+typedef struct Map
+{
+    MapEntry *e;
+    size_t cap;
+    size_t used;
+} Map;
+
+#define MAP_DELETED UINT64_MAX
+
+static size_t map_hash(uint64_t k, size_t cap)
+{
+    return (size_t)((k * 0x9E3779B97F4A7C15ull) >> 17) & (cap - 1);
+}
+
+static MapEntry *map_find(Map *m, uint64_t key)
+{
+    if (m->cap == 0)
+    {
+        return NULL;
+    }
+    for (size_t i = map_hash(key + 1, m->cap);; i = (i + 1) & (m->cap - 1))
+    {
+        if (m->e[i].key == 0)
+        {
+            return NULL;
+        }
+        if (m->e[i].key == key + 1)
+        {
+            return &m->e[i];
+        }
+    }
+}
+
+static MapEntry *map_insert(Map *m, uint64_t key)
+{
+    if ((m->used + 1) * 2 > m->cap)
+    {
+        size_t cap = m->cap ? m->cap * 2 : 1024;
+        MapEntry *e = (MapEntry *)calloc(cap, sizeof(MapEntry));
+        if (!e)
+        {
+            return NULL;
+        }
+        size_t used = 0;
+        for (size_t i = 0; i < m->cap; i++)
+        {
+            uint64_t k = m->e[i].key;
+            if (k == 0 || k == MAP_DELETED)
+            {
+                continue;
+            }
+            size_t j = map_hash(k, cap);
+            while (e[j].key != 0)
+            {
+                j = (j + 1) & (cap - 1);
+            }
+            e[j] = m->e[i];
+            used++;
+        }
+        free(m->e);
+        m->e = e;
+        m->cap = cap;
+        m->used = used;
+    }
+
+    size_t i = map_hash(key + 1, m->cap);
+    while (m->e[i].key != 0 && m->e[i].key != MAP_DELETED)
+    {
+        i = (i + 1) & (m->cap - 1);
+    }
+    if (m->e[i].key == 0)
+    {
+        m->used++;
+    }
+    m->e[i].key = key + 1;
+    return &m->e[i];
+}
+
+// ------ CITANJE TRAGA -----------
+static int read_varint(const unsigned char **p, const unsigned char *end, uint64_t *out)
+{
+    uint64_t v = 0;
+    for (unsigned shift = 0; *p < end && shift < 64; shift += 7)
+    {
+        unsigned char b = *(*p)++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static Event *trace_push(Trace *t)
+{
+    if (t->n == t->cap)
+    {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        Event *ev = (Event *)realloc(t->ev, cap * sizeof(Event));
+        if (!ev)
+        {
+            return NULL;
+        }
+        t->ev = ev;
+        t->cap = cap;
+    }
+    Event *e = &t->ev[t->n++];
+    memset(e, 0, sizeof(*e));
+    e->dep = NO_DEP;
+    return e;
+}
+
+// adrese iz traga postaju gusti indeksi objekata; indeks se ponovo koristi
+// tek kad je prethodni objekat oslobodjen, pa tabela zivih ostaje mala
+static int trace_load(const char *path, Trace *t)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 5)
+    {
+        fclose(f);
+        return -1;
+    }
+    unsigned char *buf = (unsigned char *)malloc((size_t)len);
+    if (!buf || fread(buf, 1, (size_t)len, f) != (size_t)len)
+    {
+        free(buf);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    if (memcmp(buf, HEAP_TRACE_MAGIC, 4) != 0 || buf[4] == 0 || buf[4] > HEAP_TRACE_VERSION)
+    {
+        free(buf);
+        return -1;
+    }
+
+    Map objs = {0};
+    Map slots = {0};
+    uint32_t *free_ids = NULL;
+    uint32_t *released = NULL; // po indeksu: dogadjaj koji ga je poslednji oslobodio
+    size_t free_len = 0;
+    size_t ids_cap = 0;
+    int rc = 0;
+
+    const unsigned char *p = buf + 5;
+    const unsigned char *end = buf + len;
+    while (p < end && rc == 0)
+    {
+        unsigned char op = *p++;
+        uint64_t tid = 0, addr = 0, size = 0;
+
+        if (op != TRACE_GC_FREE && op != TRACE_MOVE && read_varint(&p, end, &tid) != 0)
+        {
+            rc = -1;
+            break;
+        }
+        if (op != TRACE_COLLECT && tid > t->max_tid)
+        {
+            t->max_tid = (uint32_t)tid;
+        }
+
+        switch (op)
+        {
+        case TRACE_ALLOC:
+        {
+            if (read_varint(&p, end, &addr) != 0 || read_varint(&p, end, &size) != 0)
+            {
+                rc = -1;
+                break;
+            }
+
+            uint32_t id;
+            if (free_len > 0)
+            {
+                id = free_ids[--free_len];
+            }
+            else
+            {
+                id = t->objects++;
+                if (id >= ids_cap)
+                {
+                    size_t cap = ids_cap ? ids_cap * 2 : 1024;
+                    uint32_t *fi = (uint32_t *)realloc(free_ids, cap * sizeof(uint32_t));
+                    uint32_t *rl = fi ? (uint32_t *)realloc(released, cap * sizeof(uint32_t)) : NULL;
+                    if (!rl)
+                    {
+                        free_ids = fi ? fi : free_ids;
+                        rc = -1;
+                        break;
+                    }
+                    free_ids = fi;
+                    released = rl;
+                    for (size_t i = ids_cap; i < cap; i++)
+                    {
+                        released[i] = NO_DEP;
+                    }
+                    ids_cap = cap;
+                }
+            }
+
+            // adresa koja je vec ziva (oslobodjena mimo traga) samo menja objekat
+            MapEntry *m = map_find(&objs, addr);
+            if (m)
+            {
+                free_ids[free_len++] = m->id;
+                m->key = MAP_DELETED;
+            }
+
+            Event *e = trace_push(t);
+            m = e ? map_insert(&objs, addr) : NULL;
+            if (!m)
+            {
+                rc = -1;
+                break;
+            }
+            e->op = op;
+            e->tid = (uint32_t)tid;
+            e->id = id;
+            e->size = size;
+            e->dep = released[id];
+            m->id = id;
+            m->event = (uint32_t)(t->n - 1);
+            break;
+        }
+        case TRACE_FREE:
+        case TRACE_GC_FREE:
+        {
+            if (read_varint(&p, end, &addr) != 0)
+            {
+                rc = -1;
+                break;
+            }
+
+            // objekti alocirani pre ukljucivanja traga nisu poznati
+            MapEntry *m = map_find(&objs, addr);
+            if (!m)
+            {
+                break;
+            }
+
+            Event *e = trace_push(t);
+            if (!e)
+            {
+                rc = -1;
+                break;
+            }
+            e->op = op;
+            e->tid = (uint32_t)tid;
+            e->id = m->id;
+            e->dep = m->event;
+            released[m->id] = (uint32_t)(t->n - 1);
+            free_ids[free_len++] = m->id;
+            m->key = MAP_DELETED;
+            break;
+        }
+        case TRACE_ROOT_ADD:
+        case TRACE_ROOT_DEL:
+        {
+            uint64_t slot = 0, val = 0;
+            if (read_varint(&p, end, &slot) != 0 ||
+                (op == TRACE_ROOT_ADD && read_varint(&p, end, &val) != 0))
+            {
+                rc = -1;
+                break;
+            }
+
+            MapEntry *s = map_find(&slots, slot);
+            if (!s)
+            {
+                s = map_insert(&slots, slot);
+                if (!s)
+                {
+                    rc = -1;
+                    break;
+                }
+                s->id = t->slots++;
+            }
+            uint32_t slot_id = s->id;
+
+            MapEntry *m = val ? map_find(&objs, val - 1) : NULL;
+            Event *e = trace_push(t);
+            if (!e)
+            {
+                rc = -1;
+                break;
+            }
+            e->op = op;
+            e->tid = (uint32_t)tid;
+            e->id = slot_id;
+            if (m)
+            {
+                e->val = m->id + 1;
+                e->dep = m->event;
+            }
+            break;
+        }
+        case TRACE_MOVE:
+        {
+            // isti objekat, nova adresa; replay ne pravi dogadjaj
+            uint64_t to = 0;
+            if (read_varint(&p, end, &addr) != 0 || read_varint(&p, end, &to) != 0)
+            {
+                rc = -1;
+                break;
+            }
+
+            MapEntry *m = map_find(&objs, addr);
+            if (!m)
+            {
+                break;
+            }
+            uint32_t id = m->id;
+            uint32_t ev = m->event;
+            m->key = MAP_DELETED;
+            m = map_insert(&objs, to);
+            if (!m)
+            {
+                rc = -1;
+                break;
+            }
+            m->id = id;
+            m->event = ev;
+            break;
+        }
+        case TRACE_COLLECT:
+        {
+            Event *e = trace_push(t);
+            if (!e)
+            {
+                rc = -1;
+                break;
+            }
+            e->op = op;
+            e->tid = (uint32_t)tid;
+            break;
+        }
+        default:
+            rc = -1;
+            break;
+        }
+    }
+
+    free(objs.e);
+    free(slots.e);
+    free(free_ids);
+    free(released);
+    free(buf);
+    return rc;
+}
+
+// ------ IZVRSAVANJE -----------
+typedef struct Replay
+{
+    Heap *h;
+    Trace *t;
+    void **live;  // blok heap-a, rootovan; drzi objekte zivim
+    void **slots; // root slotovi iz traga
+    uint64_t *sizes;
+    atomic_uchar *done;
+
+    size_t allocs;
+    size_t frees;
+    size_t failed;
+    size_t collections;
+    double pause_total;
+    double pause_max;
+} Replay;
+
+typedef struct Worker
+{
+    Replay *r;
+    uint32_t tid; // 0: dogadjaji sakupljaca (GC_FREE, COLLECT)
+    size_t allocs;
+    size_t frees;
+    size_t failed;
+    pthread_t thread;
+} Worker;
+
+// prva rec objekta: po njoj se na kraju proverava da GC nije dirao zive objekte
+static uint64_t replay_tag(uint32_t id)
+{
+    return 0xA5A5000000000000ull | id;
+}
+
+static int is_collector_event(const Event *e)
+{
+    return e->op == TRACE_GC_FREE || e->op == TRACE_COLLECT;
+}
+
+static void run_event(Replay *r, Worker *w, const Event *e)
+{
+    switch (e->op)
+    {
+    case TRACE_ALLOC:
+    {
+        void *obj = alloc_heap(r->h, (size_t)e->size);
+        if (!obj)
+        {
+            w->failed++;
+        }
+        else if (e->size >= sizeof(uint64_t))
+        {
+            *(uint64_t *)obj = replay_tag(e->id);
+        }
+        r->live[e->id] = obj;
+        r->sizes[e->id] = e->size;
+        w->allocs++;
+        break;
+    }
+    case TRACE_FREE:
+        free_heap(r->h, r->live[e->id]);
+        r->live[e->id] = NULL;
+        w->frees++;
+        break;
+    case TRACE_GC_FREE:
+        r->live[e->id] = NULL;
+        break;
+    case TRACE_ROOT_ADD:
+        r->slots[e->id] = e->val ? r->live[e->val - 1] : NULL;
+        roots_add(r->h, &r->slots[e->id]);
+        break;
+    case TRACE_ROOT_DEL:
+        roots_remove(r->h, &r->slots[e->id]);
+        r->slots[e->id] = NULL;
+        break;
+    case TRACE_COLLECT:
+    {
+        double t0 = now_ms();
+        collect_heap(r->h);
+        double ms = now_ms() - t0;
+        r->collections++;
+        r->pause_total += ms;
+        if (ms > r->pause_max)
+        {
+            r->pause_max = ms;
+        }
+        break;
+    }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    Replay *r = w->r;
+
+    if (w->tid != 0)
+    {
+        thread_register(r->h);
+    }
+
+    for (size_t i = 0; i < r->t->n; i++)
+    {
+        const Event *e = &r->t->ev[i];
+        int mine = w->tid == 0 ? is_collector_event(e) : (!is_collector_event(e) && e->tid == w->tid);
+        if (!mine)
+        {
+            continue;
+        }
+
+        // zavisnosti uvek pokazuju unazad u tragu, pa cekanje ne moze da se zatvori u krug
+        if (e->dep != NO_DEP)
+        {
+            while (!atomic_load_explicit(&r->done[e->dep], memory_order_acquire))
+            {
+                if (w->tid != 0)
+                {
+                    gc_safepoint(r->h);
+                }
+                sched_yield();
+            }
+        }
+
+        run_event(r, w, e);
+        atomic_store_explicit(&r->done[i], 1, memory_order_release);
+    }
+
+    if (w->tid != 0)
+    {
+        thread_unregister(r->h);
+    }
+    return NULL;
+}
+
+// ------ REPLAY -----------
+typedef struct ReplayResult
+{
+    size_t events;
+    uint32_t objects; // najveci broj istovremeno zivih objekata
+    uint32_t threads;
+
+    size_t allocs;
+    size_t frees;
+    size_t failed;
+    size_t collections;
+    double elapsed;
+    double pause_total;
+    double pause_max;
+
+    // stanje posle traga i jos jednog ciklusa
+    size_t live;
+    size_t live_bytes;
+    size_t damaged; // zivi objekti kojima je prva rec promenjena
+} ReplayResult;
+
+// izvrsava trag nad novim heap-om; -1 ako trag ne moze da se procita ili nema memorije
+static int replay_trace(const char *path, int threaded, int engine, size_t segment, ReplayResult *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    Trace t = {0};
+    if (trace_load(path, &t) != 0)
+    {
+        fprintf(stderr, "replay: cannot read trace %s\n", path);
+        free(t.ev);
+        return -1;
+    }
+
+    Replay r = {0};
+    r.t = &t;
+    HeapConfig cfg = {0};
+    cfg.segment_size_bytes = segment;
+    cfg.engine = engine;
+    r.h = create_heap_ex(&cfg);
+    r.done = (atomic_uchar *)calloc(t.n ? t.n : 1, sizeof(atomic_uchar));
+    r.slots = (void **)calloc(t.slots ? t.slots : 1, sizeof(void *));
+    r.sizes = (uint64_t *)calloc(t.objects ? t.objects : 1, sizeof(uint64_t));
+    size_t nworkers = threaded ? (size_t)t.max_tid + 1 : 1;
+    Worker *w = (Worker *)calloc(nworkers, sizeof(Worker));
+
+    r.live = r.h ? (void **)alloc_heap(r.h, (t.objects ? t.objects : 1) * sizeof(void *)) : NULL;
+    if (!r.live || !r.done || !r.slots || !r.sizes || !w || roots_add(r.h, (void **)&r.live) != 0)
+    {
+        fprintf(stderr, "replay: out of memory\n");
+        destroy_heap(r.h);
+        free(w);
+        free(r.sizes);
+        free(r.slots);
+        free(r.done);
+        free(t.ev);
+        return -1;
+    }
+
+    double t0 = now_ms();
+    if (!threaded)
+    {
+        thread_register(r.h);
+        w[0].r = &r;
+        for (size_t i = 0; i < t.n; i++)
+        {
+            run_event(&r, &w[0], &t.ev[i]);
+        }
+        thread_unregister(r.h);
+    }
+    else
+    {
+        for (size_t k = 0; k < nworkers; k++)
+        {
+            w[k].r = &r;
+            w[k].tid = (uint32_t)k;
+        }
+        for (size_t k = 1; k < nworkers; k++)
+        {
+            pthread_create(&w[k].thread, NULL, worker_main, &w[k]);
+        }
+        worker_main(&w[0]);
+        for (size_t k = 1; k < nworkers; k++)
+        {
+            pthread_join(w[k].thread, NULL);
+        }
+    }
+    out->elapsed = now_ms() - t0;
+
+    // sve sto je trag ostavio zivim mora da prezivi jos jedan ciklus, netaknuto
+    collect_heap(r.h);
+    for (uint32_t id = 0; id < t.objects; id++)
+    {
+        if (!r.live[id])
+        {
+            continue;
+        }
+        out->live++;
+        out->live_bytes += r.sizes[id];
+        if (r.sizes[id] >= sizeof(uint64_t) && *(uint64_t *)r.live[id] != replay_tag(id))
+        {
+            out->damaged++;
+        }
+    }
+
+    for (size_t k = 0; k < nworkers; k++)
+    {
+        out->allocs += w[k].allocs;
+        out->frees += w[k].frees;
+        out->failed += w[k].failed;
+    }
+    out->events = t.n;
+    out->objects = t.objects;
+    out->threads = t.max_tid;
+    out->collections = r.collections;
+    out->pause_total = r.pause_total;
+    out->pause_max = r.pause_max;
+
+    roots_remove(r.h, (void **)&r.live);
+    destroy_heap(r.h);
+    free(w);
+    free(r.sizes);
+    free(r.slots);
+    free(r.done);
+    free(t.ev);
+    return 0;
+}
+
+// client/main.c ukljucuje ovaj fajl sa REPLAY_NO_MAIN i proverava replay svog traga
+#ifndef REPLAY_NO_MAIN
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s <trace> [-t] [-i] [-s segment_bytes]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    int threaded = 0;
+    int engine = HEAP_ENGINE_FREELIST;
+    size_t segment = 1024 * 1024;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            threaded = 1;
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            engine = HEAP_ENGINE_IMMIX;
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            segment = (size_t)strtoull(argv[++i], NULL, 0);
+        }
+        else if (!path)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!path)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ReplayResult res;
+    if (replay_trace(path, threaded, engine, segment, &res) != 0)
+    {
+        return 1;
+    }
+
+    printf("trace:        %s (%zu events, %u peak live objects, %u threads)\n", path, res.events, res.objects,
+           res.threads);
+    printf("mode:         %s, %s\n", threaded ? "threaded" : "serial",
+           engine == HEAP_ENGINE_IMMIX ? "immix" : "free list");
+    printf("allocs:       %zu (%zu failed)\n", res.allocs, res.failed);
+    printf("frees:        %zu\n", res.frees);
+    printf("elapsed:      %.2f ms (%.0f events/s)\n", res.elapsed,
+           res.elapsed > 0 ? res.events / (res.elapsed / 1e3) : 0.0);
+    printf("collections:  %zu (avg %.3f ms, max %.3f ms)\n", res.collections,
+           res.collections ? res.pause_total / res.collections : 0.0, res.pause_max);
+    printf("live at end:  %zu objects, %zu bytes (%zu damaged)\n", res.live, res.live_bytes, res.damaged);
+    return (res.failed || res.damaged) ? 1 : 0;
+}
+#endif
@@ -224,7 +224,7 @@ static void run_multithread_bigmem_test(int nthreads, int seconds, size_t msg_by
 
     for (int s = 1; s <= seconds; s++) {
         for (int k = 0; k < 10; k++) {
-            collect_heap(g_heap);
+            collect_heap_async(g_heap);
             gc_calls++;
             usleep(100 * 1000); 
         }
@@ -0,0 +1,98 @@
+#include "../heap/gc.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+struct Node
+{
+    gc::gc_ptr<Node> next;
+    std::uintptr_t payload; // nije pokazivac, precizni GC ga preskace
+    int value;
+
+    Node(Node *n, int v) : next(n), payload(0), value(v) {}
+};
+GC_POINTER_MAP(Node, next)
+
+struct Blob
+{
+    std::uintptr_t words[8];
+};
+GC_NO_POINTERS(Blob)
+
+static void *g_weak = nullptr;
+
+static Node *g_holder = nullptr;
+
+// pravi ga druga nit: adresa Blob-a nikad nije na steku ni u registrima glavne niti,
+// pa je jedina referenca payload (koji precizni GC preskace)
+static void make_hidden(Heap *h)
+{
+    assert(thread_register(h) == 0);
+    Blob *hidden = gc::make<Blob>(h);
+    hidden->words[0] = 0x1234;
+    g_weak = hidden;
+    assert(weak_add(h, &g_weak) == 0);
+
+    g_holder = gc::make<Node>(h, nullptr, 1);
+    g_holder->payload = reinterpret_cast<std::uintptr_t>(hidden);
+    assert(thread_unregister(h) == 0);
+}
+
+int main()
+{
+    Heap *h = create_heap(1024 * 1024, 0);
+    assert(h != nullptr);
+    assert(thread_register(h) == 0);
+
+    printf("[CASE 1] gc::make + gc_root keep a typed list alive\n");
+    {
+        gc::gc_root<Node> head(h);
+        for (int i = 0; i < 100; i++)
+            head = gc::make<Node>(h, head.get(), i);
+
+        collect_heap(h);
+
+        int n = 0;
+        for (Node *p = head.get(); p; p = p->next)
+        {
+            assert(p->value == 99 - n);
+            n++;
+        }
+        assert(n == 100);
+    }
+    printf("[OK] 100 nodes survive collect_heap\n");
+
+    printf("\n[CASE 2] non-pointer fields are not traced\n");
+    {
+        assert(roots_add(h, reinterpret_cast<void **>(&g_holder)) == 0);
+        std::thread(make_hidden, h).join();
+        collect_heap(h);
+
+        assert(g_weak == nullptr);
+        assert(g_holder->value == 1 && g_holder->payload != 0);
+        printf("[OK] object referenced only from payload was collected\n");
+
+        assert(weak_remove(h, &g_weak) == 0);
+        assert(roots_remove(h, reinterpret_cast<void **>(&g_holder)) == 0);
+    }
+
+    printf("\n[CASE 3] gc_root frames are LIFO\n");
+    {
+        std::size_t base = roots_frame_depth(h);
+        {
+            gc::gc_root<Node> a(h, gc::make<Node>(h, nullptr, 1));
+            gc::gc_root<Node> b(h, gc::make<Node>(h, a.get(), 2));
+            assert(roots_frame_depth(h) == base + 2);
+        }
+        assert(roots_frame_depth(h) == base);
+    }
+    printf("[OK] nested roots pop their own frames\n");
+
+    assert(thread_unregister(h) == 0);
+    destroy_heap(h);
+
+    printf("\nALL TESTS: PASS\n");
+    return 0;
+}
@@ -0,0 +1,251 @@
+#ifndef GC_HPP
+#define GC_HPP
+
+#include "heap.h"
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// C++ sloj nad heap.h (C++17, samo zaglavlje)
+namespace gc
+{
+
+// mapa pokazivaca po tipu; bez specijalizacije objekat se skenira konzervativno
+template <typename T>
+struct pointer_map
+{
+    static constexpr bool precise = false;
+};
+
+namespace detail
+{
+template <typename T>
+inline const HeapType heap_type = {sizeof(T), pointer_map<T>::count, pointer_map<T>::offsets};
+}
+
+// polje u GC objektu: tacno jedan pokazivac, bez dodatnog stanja
+template <typename T>
+class gc_ptr
+{
+public:
+    gc_ptr() noexcept : ptr_(nullptr) {}
+    gc_ptr(T *p) noexcept : ptr_(p) {}
+
+    gc_ptr &operator=(T *p) noexcept
+    {
+        ptr_ = p;
+        return *this;
+    }
+
+    T *get() const noexcept { return ptr_; }
+    T *operator->() const noexcept { return ptr_; }
+    T &operator*() const noexcept { return *ptr_; }
+    operator T *() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+private:
+    T *ptr_;
+};
+
+template <typename T, typename... Args>
+T *make(Heap *h, Args &&...args)
+{
+    static_assert(std::is_trivially_destructible<T>::value, "GC heap does not run destructors");
+    static_assert(alignof(T) <= alignof(void *) || !pointer_map<T>::precise,
+                  "precise pointer maps need alignof(T) <= alignof(void*)");
+
+    void *p;
+    if constexpr (alignof(T) > alignof(void *))
+    {
+        p = alloc_heap_aligned(h, sizeof(T), alignof(T));
+    }
+    else if constexpr (pointer_map<T>::precise)
+    {
+        p = alloc_heap_typed(h, &detail::heap_type<T>);
+    }
+    else
+    {
+        p = alloc_heap(h, sizeof(T));
+    }
+
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return ::new (p) T(std::forward<Args>(args)...);
+}
+
+// STL alokator nad GC heap-om; bafer se skenira konzervativno
+template <typename T>
+class gc_allocator
+{
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = gc_allocator<U>;
+    };
+
+    explicit gc_allocator(Heap *h) noexcept : heap_(h) {}
+
+    template <typename U>
+    gc_allocator(const gc_allocator<U> &other) noexcept : heap_(other.heap()) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > std::size_t(-1) / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+
+        void *p;
+        if constexpr (alignof(T) > alignof(void *))
+        {
+            p = alloc_heap_aligned(heap_, n * sizeof(T), alignof(T));
+        }
+        else
+        {
+            p = alloc_heap(heap_, n * sizeof(T));
+        }
+
+        if (!p)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t) noexcept
+    {
+        free_heap(heap_, p);
+    }
+
+    Heap *heap() const noexcept { return heap_; }
+
+private:
+    Heap *heap_;
+};
+
+template <typename T, typename U>
+bool operator==(const gc_allocator<T> &a, const gc_allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template <typename T, typename U>
+bool operator!=(const gc_allocator<T> &a, const gc_allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+// RAII koren nad okvirom korena niti (roots_push_frame); van registrovane niti koristi roots_add.
+// Okviri su LIFO: gc_root na steku, unisten obrnutim redom od pravljenja (ne na heap-u)
+template <typename T>
+class gc_root
+{
+public:
+    explicit gc_root(Heap *h, T *p = nullptr) : heap_(h), ptr_(p), framed_(false), depth_(0)
+    {
+        void **slots[] = {slot()};
+        if (roots_push_frame(heap_, slots, 1) == 0)
+        {
+            framed_ = true;
+            depth_ = roots_frame_depth(heap_);
+        }
+        else if (roots_add(heap_, slot()) != 0)
+        {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~gc_root()
+    {
+        if (framed_)
+        {
+            // drugaciji redosled bi skinuo tudji okvir
+            assert(roots_frame_depth(heap_) == depth_);
+            roots_pop_frame(heap_);
+        }
+        else
+        {
+            roots_remove(heap_, slot());
+        }
+    }
+
+    gc_root(const gc_root &) = delete;
+    gc_root &operator=(const gc_root &) = delete;
+
+    gc_root &operator=(T *p) noexcept
+    {
+        ptr_ = p;
+        return *this;
+    }
+
+    T *get() const noexcept { return ptr_; }
+    T *operator->() const noexcept { return ptr_; }
+    T &operator*() const noexcept { return *ptr_; }
+    operator T *() const noexcept { return ptr_; }
+
+private:
+    void **slot() noexcept { return reinterpret_cast<void **>(&ptr_); }
+
+    Heap *heap_;
+    T *ptr_;
+    bool framed_;
+    size_t depth_;
+};
+
+} // namespace gc
+
+#define GC_PM_1(T, a) offsetof(T, a)
+#define GC_PM_2(T, a, ...) offsetof(T, a), GC_PM_1(T, __VA_ARGS__)
+#define GC_PM_3(T, a, ...) offsetof(T, a), GC_PM_2(T, __VA_ARGS__)
+#define GC_PM_4(T, a, ...) offsetof(T, a), GC_PM_3(T, __VA_ARGS__)
+#define GC_PM_5(T, a, ...) offsetof(T, a), GC_PM_4(T, __VA_ARGS__)
+#define GC_PM_6(T, a, ...) offsetof(T, a), GC_PM_5(T, __VA_ARGS__)
+#define GC_PM_7(T, a, ...) offsetof(T, a), GC_PM_6(T, __VA_ARGS__)
+#define GC_PM_8(T, a, ...) offsetof(T, a), GC_PM_7(T, __VA_ARGS__)
+#define GC_PM_PICK(_1, _2, _3, _4, _5, _6, _7, _8, NAME, ...) NAME
+#define GC_PM_OFFSETS(T, ...) \
+    GC_PM_PICK(__VA_ARGS__, GC_PM_8, GC_PM_7, GC_PM_6, GC_PM_5, GC_PM_4, GC_PM_3, GC_PM_2, GC_PM_1)(T, __VA_ARGS__)
+
+// GC_POINTER_MAP(Node, next, child) -- koristiti u globalnom prostoru imena
+#define GC_POINTER_MAP(T, ...)                                                  \
+    namespace gc                                                                \
+    {                                                                           \
+    template <>                                                                 \
+    struct pointer_map<T>                                                       \
+    {                                                                           \
+        static_assert(std::is_standard_layout<T>::value, "offsetof needs a standard-layout type"); \
+        static constexpr bool precise = true;                                   \
+        static constexpr std::size_t table[] = {GC_PM_OFFSETS(T, __VA_ARGS__)}; \
+        static constexpr std::size_t count = sizeof(table) / sizeof(table[0]);  \
+        static constexpr const std::size_t *offsets = table;                    \
+    };                                                                          \
+    }
+
+// tip bez pokazivaca: nikad se ne skenira
+#define GC_NO_POINTERS(T)                                       \
+    namespace gc                                                \
+    {                                                           \
+    template <>                                                 \
+    struct pointer_map<T>                                       \
+    {                                                           \
+        static constexpr bool precise = true;                   \
+        static constexpr std::size_t count = 0;                 \
+        static constexpr const std::size_t *offsets = nullptr;  \
+    };                                                          \
+    }
+
+#endif
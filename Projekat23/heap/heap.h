@@ -3,23 +3,154 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct Heap Heap;
+typedef struct EphemeronTable EphemeronTable;
+typedef struct HeapPool HeapPool;
+typedef struct HeapRegion HeapRegion;
+typedef struct HeapScanRange HeapScanRange;
+typedef unsigned long long GcTicket;
+typedef void (*HeapFinalizer)(void* obj);
+typedef void (*HeapPressureFn)(Heap* h, size_t heap_bytes, void* ctx);
+
+// HEAP_ENGINE_IMMIX: mali objekti se alociraju u linije blokova, a GC retke blokove
+// prazni premestanjem; pomera se samo objekat do kog vode iskljucivo precizne reference
+// (roots_add slotovi, okviri korena, polja tipiziranih objekata). Pokazivac koji drzi
+// neregistrovana nit se ne azurira.
+enum
+{
+    HEAP_ENGINE_FREELIST = 0,
+    HEAP_ENGINE_IMMIX = 1
+};
+
+typedef struct HeapConfig
+{
+    size_t segment_size_bytes;
+    size_t gc_threshold_bytes;
+    size_t reserve_bytes;
+    int    huge_pages;
+    int    engine;
+    // heap koji koristi samo jedna nit: bez lock-a, safepoint-a i niti sakupljaca;
+    // collect_heap radi odmah na pozivaocu (isto za sve heap-ove uz -DHEAP_SINGLE_THREADED)
+    int    single_thread;
+    // velicina heap-a = memorija uzeta od OS-a. Preko meke granice: GC odmah, pa
+    // povratni pozivi pritiska (jednom, dok heap_trim ne spusti heap ispod 7/8 granice).
+    // Preko tvrde granice heap ne raste i alokacija vraca NULL. 0 = bez granice.
+    size_t soft_limit_bytes;
+    size_t hard_limit_bytes;
+} HeapConfig;
+
+// zastavice za try_alloc_heap
+enum
+{
+    HEAP_ALLOC_UNINIT = 1 // kao alloc_heap_uninit: bez nuliranja, sadrzaj se ne skenira
+};
+
+typedef struct HeapType
+{
+    size_t size;
+    size_t pointer_count;
+    const size_t* pointer_offsets;
+} HeapType;
 
 Heap* create_heap(size_t segment_size_bytes, size_t gc_threshold_bytes);
+Heap* create_heap_ex(const HeapConfig* cfg);
 void  destroy_heap(Heap* h);
 
+// ako stara adresa nije slobodna, heap_load relocira sliku: tipizirana polja i koreni su
+// precizni, ali se u netipiziranom objektu menja svaka rec koja lici na adresu iz heap-a
+// (kao sto je GC konzervativno cuva). Podaci koji nisu pokazivaci idu u alloc_heap_uninit
+// (NOSCAN) ili tipizirane objekte; oni se ne diraju, ni u vec ucitanoj slici.
+// heap_save zaustavlja ostale registrovane niti dok pise (kao GC); nit u native stanju
+// tada ne sme da menja objekte iz heap-a.
+int   heap_save(Heap* h, const char* path, void* const* roots, size_t n_roots);
+Heap* heap_load(const char* path, const HeapConfig* cfg, void** roots, size_t n_roots);
+
 void* alloc_heap(Heap* h, size_t size_bytes);
+void* alloc_heap_uninit(Heap* h, size_t size_bytes);
+void* alloc_heap_aligned(Heap* h, size_t size_bytes, size_t align);
+void* alloc_heap_typed(Heap* h, const HeapType* type);
+void* try_alloc_heap(Heap* h, size_t size_bytes, unsigned flags);
+void* realloc_heap(Heap* h, void* ptr, size_t size_bytes);
+
+// fn se zove jednom, na niti finalizatora, ciklus posle onog u kom je objekat postao
+// nedostizan; do tada objekat i sve na sta pokazuje ostaju na heap-u
+void* alloc_heap_finalizable(Heap* h, size_t size_bytes, HeapFinalizer fn);
+// ceka fn koje je GC do sada uredio; pozvan iz samog fn odmah se vraca
+void  heap_finalize_wait(Heap* h);
+
 void  free_heap(Heap* h, void* ptr);
 
+size_t alloc_heap_batch(Heap* h, size_t size_bytes, size_t n, void** out);
+void  free_heap_batch(Heap* h, void** ptrs, size_t n);
+
+HeapPool* heap_pool_create(Heap* h, size_t obj_size);
+void  heap_pool_destroy(HeapPool* p);
+void* heap_pool_alloc(HeapPool* p);
+void  heap_pool_free(HeapPool* p, void* obj);
+
+HeapRegion* heap_region_begin(Heap* h);
+void* heap_region_alloc(HeapRegion* r, size_t size_bytes);
+void  heap_region_end(HeapRegion* r);
+void  heap_store(Heap* h, void** slot, void* value);
+
 void  collect_heap(Heap* h);
+GcTicket collect_heap_async(Heap* h);
+void  collect_heap_wait(Heap* h, GcTicket ticket);
+int   collect_heap_done(Heap* h, GcTicket ticket);
 
 int   roots_add(Heap* h, void** slot);
 int   roots_remove(Heap* h, void** slot);
+int   roots_push_frame(Heap* h, void** slots[], size_t n);
+int   roots_pop_frame(Heap* h);
+size_t roots_frame_depth(Heap* h); // broj okvira niti; 0 van registrovane niti
+
+// dodatni konzervativni koreni: stek fibera ili niz pokazivaca. heap_scan_range_set
+// ne zakljucava: sacuvani sp fibera pri izlasku sa steka, NULL iskljucuje opseg.
+// Opseg na kom neka registrovana nit upravo radi skenira se od njenog sp; njen
+// sopstveni stek se tada skenira od sp sacuvanog u thread_enter_fiber, a bez tog
+// poziva se ne skenira (i on moze biti opseg).
+HeapScanRange* heap_add_scan_range(Heap* h, void* lo, void* hi);
+void  heap_scan_range_set(HeapScanRange* r, void* from);
+int   heap_remove_scan_range(Heap* h, HeapScanRange* r);
+
+int   weak_add(Heap* h, void** slot);
+int   weak_remove(Heap* h, void** slot);
+
+EphemeronTable* ephemeron_create(Heap* h);
+void  ephemeron_destroy(EphemeronTable* t);
+int   ephemeron_put(EphemeronTable* t, void* key, void* value);
+void* ephemeron_get(EphemeronTable* t, void* key);
+int   ephemeron_remove(EphemeronTable* t, void* key);
+size_t ephemeron_count(EphemeronTable* t);
+
+// fn se zove na niti sakupljaca posle ciklusa; collect_heap iz fn samo trazi sledeci ciklus
+int   heap_add_pressure_callback(Heap* h, HeapPressureFn fn, void* ctx);
+int   heap_remove_pressure_callback(Heap* h, HeapPressureFn fn, void* ctx);
+size_t heap_size_bytes(Heap* h);
+size_t heap_trim(Heap* h);
+
+int   heap_trace_start(Heap* h, const char* path);
+int   heap_trace_stop(Heap* h);
 
+// SIGUSR2 (HEAP_SUSPEND_SIGNAL) je rezervisan za zaustavljanje niti tokom GC-a:
+// nit koja ga blokira ne moze da se registruje (-1), a ciklus koji ne moze da
+// zaustavi nit (signal blokiran kasnije) se posle HEAP_SUSPEND_TIMEOUT_MS preskace.
+// Signal prekida i spavanje registrovane niti: nanosleep/usleep (i poll, select...)
+// vracaju ranije sa EINTR u svakom ciklusu, uprkos SA_RESTART. Spavanje treba
+// ponavljati sa preostalim vremenom ili ga obuhvatiti sa thread_enter_native.
 int   thread_register(Heap* h);
 int   thread_unregister(Heap* h);
 void  gc_safepoint(Heap* h);
+void  thread_enter_native(Heap* h);
+void  thread_leave_native(Heap* h);
+void  thread_enter_fiber(Heap* h); // na sopstvenom steku, pre svakog prelaska na fiber
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif 
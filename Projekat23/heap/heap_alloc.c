@@ -1,43 +1,177 @@
 #include "heap_state.h"
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
 
 static void free_list_push(BlockHeader **head, BlockHeader *block)
 {
-    block->next_free = *head;
+    block_set_next_free(block, *head);
     *head = block;
 }
 
+// next je u payload-u; posle skidanja rec se vraca na nulu (ZEROED blokovi)
 static void free_list_remove(BlockHeader **head, BlockHeader *prev, BlockHeader *cur)
 {
     if (prev)
     {
-        prev->next_free = cur->next_free;
+        block_set_next_free(prev, block_next_free(cur));
     }
     else
     {
-        *head = cur->next_free;
+        *head = block_next_free(cur);
+    }
+    block_set_next_free(cur, NULL);
+}
+
+#define HEAP_DEFAULT_RESERVE ((size_t)16 << 30)
+#define HEAP_MIN_RESERVE ((size_t)256 << 20)
+#define HEAP_HUGE_PAGE ((size_t)2 << 20)
+
+static size_t round_up(size_t x, size_t a)
+{
+    return (x + (a - 1)) / a * a;
+}
+
+// REZERVISI ADRESNI OPSEG (hint: pozeljna adresa, samo za prvi pokusaj)
+static int heap_reserve(Heap *h, size_t reserve_bytes, void *hint)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t extra = (h->segment_align > page) ? h->segment_align : 0;
+    size_t size = round_up(reserve_bytes, h->segment_align);
+    void *base = MAP_FAILED;
+
+    for (;;)
+    {
+        base = mmap(hint, size + extra, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        hint = NULL;
+        if (base != MAP_FAILED || size <= HEAP_MIN_RESERVE)
+        {
+            break;
+        }
+        size /= 2;
+    }
+    if (base == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    h->reserve_base = base;
+    h->reserve_len = size + extra;
+    h->reserve_lo = (unsigned char *)round_up((size_t)base, h->segment_align);
+    h->reserve_hi = h->reserve_lo + size;
+    h->reserve_top = h->reserve_lo;
+    return 0;
+}
+
+// COMMIT IZ REZERVACIJE (size je umnozak segment_align)
+void *reserve_commit(Heap *h, size_t size)
+{
+    if (size > (size_t)(h->reserve_hi - h->reserve_top))
+    {
+        return NULL;
+    }
+    if (h->hard_limit_bytes && h->committed_bytes + size > h->hard_limit_bytes)
+    {
+        return NULL;
+    }
+
+    unsigned char *mem = h->reserve_top;
+    if (mprotect(mem, size, PROT_READ | PROT_WRITE) != 0)
+    {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (h->huge_pages)
+    {
+        madvise(mem, size, MADV_HUGEPAGE);
+    }
+#endif
+    h->reserve_top += size;
+    h->committed_bytes += size;
+    heap_pressure_check(h);
+    return mem;
+}
+
+// ------ CHUNKOVI (slabovi i regioni) -----------
+unsigned char *chunk_take(Heap *h, unsigned char kind)
+{
+    if (!h->free_chunks)
+    {
+        size_t size = (h->segment_align > HEAP_CHUNK_BYTES) ? h->segment_align : HEAP_CHUNK_BYTES;
+        unsigned char *mem = (unsigned char *)reserve_commit(h, size);
+        if (!mem)
+        {
+            return NULL;
+        }
+        for (size_t off = size; off > 0; off -= HEAP_CHUNK_BYTES)
+        {
+            chunk_give(h, mem + off - HEAP_CHUNK_BYTES);
+        }
+    }
+
+    unsigned char *c = (unsigned char *)h->free_chunks;
+    h->free_chunks = *(void **)(void *)c;
+    unsigned char *slot = &h->chunk_map[(size_t)(c - h->reserve_lo) / HEAP_CHUNK_BYTES];
+    if (*slot == CHUNK_RELEASED)
+    {
+        h->committed_bytes += HEAP_CHUNK_BYTES;
+        heap_pressure_check(h);
+    }
+    *slot = kind;
+    return c;
+}
+
+void chunk_give(Heap *h, void *chunk)
+{
+    unsigned char *c = (unsigned char *)chunk;
+    h->chunk_map[(size_t)(c - h->reserve_lo) / HEAP_CHUNK_BYTES] = CHUNK_FREE;
+    *(void **)chunk = h->free_chunks;
+    h->free_chunks = chunk;
+}
+
+// stranice idu OS-u, adresni opseg ostaje; posle toga citaju se kao nule
+int heap_pages_release(void *p, size_t size)
+{
+    return mmap(p, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANON, -1, 0) != MAP_FAILED;
+}
+
+// heap_trim: stranice chunka idu OS-u; chunk_take ga ponovo racuna u heap
+void chunk_release(Heap *h, void *chunk)
+{
+    int released = heap_pages_release(chunk, HEAP_CHUNK_BYTES);
+    chunk_give(h, chunk);
+    if (released)
+    {
+        h->chunk_map[(size_t)((unsigned char *)chunk - h->reserve_lo) / HEAP_CHUNK_BYTES] = CHUNK_RELEASED;
+        h->committed_bytes -= HEAP_CHUNK_BYTES;
     }
-    cur->next_free = NULL;
 }
 
 // NAPRAVI SEGMENT
-static Segment *segment_create(size_t size_bytes)
+static Segment *segment_create(Heap *h, size_t size_bytes)
 {
+    size_t size = round_up(size_bytes, h->segment_align);
+
     Segment *seg = (Segment *)malloc(sizeof(Segment));
     if (!seg)
     {
         return NULL;
     }
 
-    seg->mem = (unsigned char *)malloc(size_bytes);
-    if (!seg->mem)
+    unsigned char *mem = (unsigned char *)reserve_commit(h, size);
+    if (!mem)
     {
         free(seg);
         return NULL;
     }
 
-    seg->size = size_bytes;
+    seg->mem = mem;
+    seg->size = size;
     seg->next = NULL;
     return seg;
 }
@@ -48,7 +182,6 @@ static void segment_destroy_all(Segment *seg)
     while (seg)
     {
         Segment *next = seg->next;
-        free(seg->mem);
         free(seg);
         seg = next;
     }
@@ -57,18 +190,39 @@ static void segment_destroy_all(Segment *seg)
 // KREIRAJ HEAP
 Heap *create_heap(size_t segment_size_bytes, size_t gc_threshold_bytes)
 {
+    HeapConfig cfg = {0};
+    cfg.segment_size_bytes = segment_size_bytes;
+    cfg.gc_threshold_bytes = gc_threshold_bytes;
+    return create_heap_ex(&cfg);
+}
+
+Heap *create_heap_ex(const HeapConfig *cfg)
+{
+    return heap_create_image(cfg, NULL, 0);
+}
+
+// image_bytes na pocetku rezervacije ostaje za sliku heap-a (heap_load)
+Heap *heap_create_image(const HeapConfig *cfg, void *hint, size_t image_bytes)
+{
+    if (!cfg || cfg->segment_size_bytes <= sizeof(BlockHeader))
+    {
+        return NULL;
+    }
+
     Heap *h = (Heap *)calloc(1, sizeof(Heap));
     if (!h)
     {
         return NULL;
     }
 
-    h->roots = NULL;
-    h->roots_count = 0;
-    h->roots_capacity = 0;
-
-    h->segment_size_bytes = segment_size_bytes;
-    h->gc_threshold_bytes = gc_threshold_bytes;
+    h->segment_size_bytes = cfg->segment_size_bytes;
+    h->gc_threshold_bytes = cfg->gc_threshold_bytes;
+    h->huge_pages = cfg->huge_pages;
+    h->engine = cfg->engine;
+    h->single_thread = cfg->single_thread;
+    // segmenti su umnozak velicine chunka, pa su chunkovi uvek poravnati
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    h->segment_align = h->huge_pages ? HEAP_HUGE_PAGE : (page > HEAP_CHUNK_BYTES ? page : HEAP_CHUNK_BYTES);
 
     if (pthread_mutex_init(&h->lock, NULL) != 0)
     {
@@ -76,9 +230,52 @@ Heap *create_heap(size_t segment_size_bytes, size_t gc_threshold_bytes)
         return NULL;
     }
 
-    Segment *seg = segment_create(segment_size_bytes);
+    size_t reserve = cfg->reserve_bytes ? cfg->reserve_bytes : HEAP_DEFAULT_RESERVE;
+    if (reserve < image_bytes + h->segment_size_bytes)
+    {
+        reserve = image_bytes + h->segment_size_bytes;
+    }
+    if (heap_reserve(h, reserve, hint) != 0)
+    {
+        pthread_mutex_destroy(&h->lock);
+        free(h);
+        return NULL;
+    }
+
+    // bajt po chunku i bit po reci rezervacije; stranice se alociraju tek kad se upisu
+    size_t span = (size_t)(h->reserve_hi - h->reserve_lo);
+    size_t map_bytes = round_up(span / HEAP_CHUNK_BYTES, sizeof(uint64_t));
+    h->chunk_map_len = map_bytes + span / HEAP_ALIGNMENT / 8;
+    h->chunk_map = (unsigned char *)mmap(NULL, h->chunk_map_len, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    h->block_starts = (uint64_t *)(void *)(h->chunk_map + map_bytes);
+    if (h->chunk_map == MAP_FAILED)
+    {
+        munmap(h->reserve_base, h->reserve_len);
+        pthread_mutex_destroy(&h->lock);
+        free(h);
+        return NULL;
+    }
+
+    if (image_bytes > 0)
+    {
+        size_t n = round_up(image_bytes, h->segment_align);
+        if (!reserve_commit(h, n))
+        {
+            munmap(h->chunk_map, h->chunk_map_len);
+            munmap(h->reserve_base, h->reserve_len);
+            pthread_mutex_destroy(&h->lock);
+            free(h);
+            return NULL;
+        }
+        memset(h->chunk_map, CHUNK_IMAGE, n / HEAP_CHUNK_BYTES);
+    }
+
+    Segment *seg = segment_create(h, h->segment_size_bytes);
     if (!seg)
     {
+        munmap(h->chunk_map, h->chunk_map_len);
+        munmap(h->reserve_base, h->reserve_len);
         pthread_mutex_destroy(&h->lock);
         free(h);
         return NULL;
@@ -87,16 +284,32 @@ Heap *create_heap(size_t segment_size_bytes, size_t gc_threshold_bytes)
 
     BlockHeader *block = (BlockHeader *)seg->mem;
     block->size = seg->size - sizeof(BlockHeader);
-    block->magic = BLOCK_MAGIC;
-    block->flags = BLOCK_FLAG_FREE;
-    block->next_free = NULL;
+    block->flags = BLOCK_FLAG_FREE | BLOCK_FLAG_ZEROED;
+    block_start_set(h, block);
 
-    h->free_list = NULL;
-    free_list_push(&h->free_list, block);
+    memset(h->free_lists, 0, sizeof(h->free_lists));
+    free_list_push(free_list_of(h, block->size), block);
 
-    pthread_cond_init(&h->gc_cond, NULL);
     h->threads = NULL;
-    h->gc_requested = 0;
+    atomic_init(&h->gc_requested, 0);
+    atomic_init(&h->try_miss_bytes, 0);
+    atomic_init(&h->pressure_pending, 0);
+    atomic_init(&h->pressure_collect, 0);
+    atomic_init(&h->region_large, 0);
+
+    if (!heap_single(h) && collector_start(h) != 0)
+    {
+        segment_destroy_all(h->segments);
+        munmap(h->chunk_map, h->chunk_map_len);
+        munmap(h->reserve_base, h->reserve_len);
+        pthread_mutex_destroy(&h->lock);
+        free(h);
+        return NULL;
+    }
+
+    // granice vaze tek kad sakupljac radi; pocetni segment se ne racuna kao prelaz
+    h->soft_limit_bytes = cfg->soft_limit_bytes;
+    h->hard_limit_bytes = cfg->hard_limit_bytes;
 
     return h;
 }
@@ -109,24 +322,226 @@ void destroy_heap(Heap *h)
         return;
     }
 
-    pthread_mutex_lock(&h->lock);
+    // finalizatori mogu da alociraju i zovu collect_heap, pa sakupljac staje posle njih
+    final_stop(h);
+    if (!heap_single(h))
+    {
+        collector_stop(h);
+    }
+    heap_trace_stop(h);
+
+    heap_lock(h);
     segment_destroy_all(h->segments);
     h->segments = NULL;
-    h->free_list = NULL;
-    pthread_mutex_unlock(&h->lock);
+    memset(h->free_lists, 0, sizeof(h->free_lists));
+    pool_destroy_all(h);
+    region_destroy_all(h);
+    h->free_chunks = NULL;
+    munmap(h->chunk_map, h->chunk_map_len);
+    munmap(h->reserve_base, h->reserve_len);
+    h->reserve_top = h->reserve_lo = h->reserve_hi = NULL;
+    heap_unlock(h);
 
     pthread_mutex_destroy(&h->lock);
-    pthread_cond_destroy(&h->gc_cond);
 
-    free(h->roots);
-    h->roots = NULL;
-    h->roots_count = 0;
-    h->roots_capacity = 0;
+    slotset_destroy(&h->roots);
+    slotset_destroy(&h->weak);
+    slotset_destroy(&h->image_slots);
+    free(h->image_relocs);
+    scan_ranges_destroy(h);
+    free(h->pressure_cbs);
+
+    while (h->ephemerons)
+    {
+        EphemeronTable *t = h->ephemerons;
+        h->ephemerons = t->next;
+        free(t->entries);
+        free(t);
+    }
     free(h);
 }
 
-// ALOKACIJA MEMORIJE
-void *alloc_heap(Heap *h, size_t size_bytes)
+// pomeraj poravnatog payload-a unutar slobodnog bloka, SIZE_MAX ako ne staje
+static size_t aligned_offset(const BlockHeader *b, size_t req, size_t align)
+{
+    if (b->size < req)
+    {
+        return SIZE_MAX;
+    }
+    if (align <= HEAP_ALIGNMENT)
+    {
+        return 0;
+    }
+
+    size_t start = (size_t)(const void *)(b + 1);
+    size_t a = (start + (align - 1)) & ~(align - 1);
+    while (a != start && a - start < sizeof(BlockHeader) + HEAP_ALIGNMENT)
+    {
+        a += align;
+    }
+
+    size_t off = a - start;
+    if (off > b->size || b->size - off < req)
+    {
+        return SIZE_MAX;
+    }
+    return off;
+}
+
+// prvi odgovarajuci blok, od klase zahteva navise; *head_out je lista u kojoj je nadjen
+static BlockHeader *free_list_find(Heap *h, size_t req, size_t align, BlockHeader ***head_out,
+                                   BlockHeader **prev_out, size_t *off_out)
+{
+    for (size_t k = free_class(req); k < HEAP_FREE_CLASSES; k++)
+    {
+        BlockHeader *prev = NULL;
+        BlockHeader *cur = h->free_lists[k];
+
+        while (cur)
+        {
+            if (cur->flags & BLOCK_FLAG_FREE)
+            {
+                size_t off = aligned_offset(cur, req, align);
+                if (off != SIZE_MAX)
+                {
+                    *head_out = &h->free_lists[k];
+                    *prev_out = prev;
+                    *off_out = off;
+                    return cur;
+                }
+            }
+            prev = cur;
+            cur = block_next_free(cur);
+        }
+    }
+    return NULL;
+}
+
+// NOV SEGMENT u kom staje req sa datim poravnanjem; ceo ide u listu kao jedan slobodan blok
+static int heap_grow(Heap *h, size_t req, size_t align)
+{
+    size_t need = sizeof(BlockHeader) + req;
+    if (align > HEAP_ALIGNMENT)
+    {
+        need += align + sizeof(BlockHeader);
+    }
+
+    Segment *nseg = segment_create(h, need > h->segment_size_bytes ? need : h->segment_size_bytes);
+    if (!nseg)
+    {
+        return -1;
+    }
+    nseg->next = h->segments;
+    h->segments = nseg;
+
+    BlockHeader *nb = (BlockHeader *)(void *)nseg->mem;
+    nb->size = nseg->size - sizeof(BlockHeader);
+    nb->flags = BLOCK_FLAG_FREE | BLOCK_FLAG_ZEROED;
+    block_start_set(h, nb);
+    free_list_push(free_list_of(h, nb->size), nb);
+    return 0;
+}
+
+// UZMI SLOBODAN BLOK (uz grow po potrebi novi segment), vodeci visak vraca u listu
+static BlockHeader *free_list_take(Heap *h, size_t req, size_t align, int grow)
+{
+    BlockHeader **head = NULL;
+    BlockHeader *prev = NULL;
+    size_t off = 0;
+    BlockHeader *cur = free_list_find(h, req, align, &head, &prev, &off);
+
+    if (!cur)
+    {
+        if (!grow || heap_grow(h, req, align) != 0)
+        {
+            return NULL;
+        }
+
+        cur = free_list_find(h, req, align, &head, &prev, &off);
+        if (!cur)
+        {
+            return NULL;
+        }
+    }
+
+    free_list_remove(head, prev, cur);
+    block_reclaim(h, cur);
+
+    if (off > 0)
+    {
+        unsigned char *payload = (unsigned char *)(void *)(cur + 1);
+        BlockHeader *ab = (BlockHeader *)(void *)(payload + off) - 1;
+        ab->size = cur->size - off;
+        ab->flags = cur->flags;
+        block_start_set(h, ab);
+
+        cur->size = off - sizeof(BlockHeader);
+        free_list_push(free_list_of(h, cur->size), cur);
+        cur = ab;
+    }
+    return cur;
+}
+
+// ISECI BLOK NA n UZASTOPNIH OBJEKATA
+static size_t carve_block(Heap *h, BlockHeader *cur, size_t req, size_t n, void **out, uint32_t flags, int clear)
+{
+    uint32_t zeroed = cur->flags & BLOCK_FLAG_ZEROED;
+    size_t stride = sizeof(BlockHeader) + req;
+    size_t avail = sizeof(BlockHeader) + cur->size;
+
+    size_t k = avail / stride;
+    if (k > n)
+    {
+        k = n;
+    }
+
+    size_t remaining = avail - k * stride;
+    unsigned char *base = (unsigned char *)(void *)cur;
+
+    for (size_t i = 0; i < k; i++)
+    {
+        BlockHeader *b = (BlockHeader *)(void *)(base + i * stride);
+        b->size = req;
+        b->flags = flags;
+        block_start_set(h, b);
+        out[i] = (void *)(b + 1);
+    }
+
+    if (remaining > sizeof(BlockHeader) + HEAP_ALIGNMENT)
+    {
+        BlockHeader *split = (BlockHeader *)(void *)(base + k * stride);
+        split->size = remaining - sizeof(BlockHeader);
+        split->flags = BLOCK_FLAG_FREE | zeroed;
+        block_start_set(h, split);
+
+        free_list_push(free_list_of(h, split->size), split);
+    }
+    else
+    {
+        BlockHeader *last = (BlockHeader *)(void *)(base + (k - 1) * stride);
+        last->size += remaining;
+    }
+
+    for (size_t i = 0; i < k; i++)
+    {
+        BlockHeader *b = (BlockHeader *)out[i] - 1;
+        h->allocated_bytes += b->size;
+        if (clear && !zeroed)
+        {
+            memset(out[i], 0, b->size);
+        }
+    }
+
+    return k;
+}
+
+// Immix uzima male objekte bez posebnog poravnanja; ostalo ide u segmente
+static int immix_takes(const Heap *h, size_t req, size_t align)
+{
+    return h->engine == HEAP_ENGINE_IMMIX && align <= HEAP_ALIGNMENT && sizeof(BlockHeader) + req <= IMMIX_MAX_OBJECT;
+}
+
+static void *alloc_one(Heap *h, size_t size_bytes, size_t align, uint32_t flags, int clear, const HeapType *type)
 {
     if (!h || size_bytes == 0)
     {
@@ -137,114 +552,297 @@ void *alloc_heap(Heap *h, size_t size_bytes)
 
     size_t req = heap_align_up(size_bytes);
 
-    pthread_mutex_lock(&h->lock);
+    heap_lock(h);
 
-    BlockHeader *prev = NULL;
-    BlockHeader *cur = h->free_list;
-
-    while (cur)
+    void *out = NULL;
+    BlockHeader *cur;
+    if (immix_takes(h, req, align))
     {
-        if ((cur->flags & BLOCK_FLAG_FREE) && cur->size >= req)
+        cur = immix_alloc(h, req, flags, 1);
+        out = cur ? (void *)(cur + 1) : NULL;
+    }
+    else
+    {
+        cur = free_list_take(h, req, align, 1);
+        if (cur)
         {
-            break;
+            carve_block(h, cur, req, 1, &out, flags, clear);
         }
-        prev = cur;
-        cur = cur->next_free;
     }
-
     if (!cur)
     {
-        Segment *nseg = segment_create(h->segment_size_bytes);
-        if (!nseg)
+        heap_unlock(h);
+        return NULL;
+    }
+
+    if (type)
+    {
+        *block_type_slot(cur) = type;
+    }
+    if (h->trace)
+    {
+        trace_alloc(h, out, size_bytes);
+    }
+    heap_unlock(h);
+
+    // jednonitni heap je presao meku granicu; out je na steku registrovanog vlasnika
+    if (heap_single(h) && atomic_load(&h->pressure_pending) && thread_current(h))
+    {
+        collect_heap(h);
+    }
+    else if (!heap_single(h) && atomic_load(&h->pressure_collect) && atomic_exchange(&h->pressure_collect, 0))
+    {
+        collect_heap_async(h);
+    }
+    return out;
+}
+
+// ALOKACIJA BEZ CEKANJA: bez safepoint-a, bez cekanja na lock i bez rasta heap-a;
+// promasaj se belezi i budi sakupljaca, koji posle ciklusa dopuni heap
+void *try_alloc_heap(Heap *h, size_t size_bytes, unsigned flags)
+{
+    if (!h || size_bytes == 0)
+    {
+        return NULL;
+    }
+
+    size_t req = heap_align_up(size_bytes);
+    uint32_t bflags = (flags & HEAP_ALLOC_UNINIT) ? BLOCK_FLAG_NOSCAN : 0;
+
+    // dok ciklus traje lock drzi sakupljac
+    if (atomic_load(&h->gc_requested) || heap_trylock(h) != 0)
+    {
+        return NULL;
+    }
+
+    void *out = NULL;
+    BlockHeader *cur;
+    if (immix_takes(h, req, 0))
+    {
+        cur = immix_alloc(h, req, bflags, 0);
+        out = cur ? (void *)(cur + 1) : NULL;
+    }
+    else
+    {
+        cur = free_list_take(h, req, 0, 0);
+        if (cur)
         {
-            pthread_mutex_unlock(&h->lock);
-            return NULL;
+            carve_block(h, cur, req, 1, &out, bflags, !(flags & HEAP_ALLOC_UNINIT));
         }
-        nseg->next = h->segments;
-        h->segments = nseg;
-
-        BlockHeader *nb = (BlockHeader *)(void *)nseg->mem;
-        nb->size = nseg->size - sizeof(BlockHeader);
-        nb->magic = BLOCK_MAGIC;
-        nb->flags = BLOCK_FLAG_FREE;
-        nb->next_free = NULL;
-        free_list_push(&h->free_list, nb);
-
-        prev = NULL;
-        cur = h->free_list;
-        while (cur)
+    }
+    if (out && h->trace)
+    {
+        trace_alloc(h, out, size_bytes);
+    }
+    heap_unlock(h);
+
+    if (!out)
+    {
+        size_t prev = atomic_load(&h->try_miss_bytes);
+        while (prev < req && !atomic_compare_exchange_weak(&h->try_miss_bytes, &prev, req))
         {
-            if ((cur->flags & BLOCK_FLAG_FREE) && cur->size >= req)
-            {
-                break;
-            }
-            prev = cur;
-            cur = cur->next_free;
         }
+        collect_request_nowait(h);
+    }
+    return out;
+}
 
-        if (!cur)
+// zove nit sakupljaca posle ciklusa: da sledeci try_alloc_heap od size_bytes uspe
+void heap_refill(Heap *h, size_t size_bytes)
+{
+    size_t req = heap_align_up(size_bytes);
+
+    heap_lock(h);
+    if (immix_takes(h, req, 0))
+    {
+        immix_refill(h, req);
+    }
+    else
+    {
+        BlockHeader **head = NULL;
+        BlockHeader *prev = NULL;
+        size_t off = 0;
+        if (!free_list_find(h, req, 0, &head, &prev, &off))
         {
-            pthread_mutex_unlock(&h->lock);
-            return NULL;
+            heap_grow(h, req, 0);
         }
     }
+    heap_unlock(h);
+}
 
-    free_list_remove(&h->free_list, prev, cur);
+// ALOKACIJA MEMORIJE
+void *alloc_heap(Heap *h, size_t size_bytes)
+{
+    return alloc_one(h, size_bytes, 0, 0, 1, NULL);
+}
+
+// ALOKACIJA BEZ NULIRANJA (bafer bez pokazivaca)
+void *alloc_heap_uninit(Heap *h, size_t size_bytes)
+{
+    return alloc_one(h, size_bytes, 0, BLOCK_FLAG_NOSCAN, 0, NULL);
+}
 
-    size_t remaining = 0;
-    if (cur->size > req)
+// PORAVNATA ALOKACIJA (align je stepen dvojke)
+void *alloc_heap_aligned(Heap *h, size_t size_bytes, size_t align)
+{
+    if (align == 0 || (align & (align - 1)) != 0)
     {
-        remaining = cur->size - req;
+        return NULL;
     }
+    return alloc_one(h, size_bytes, align, 0, 1, NULL);
+}
 
-    if (remaining > sizeof(BlockHeader) + HEAP_ALIGNMENT)
+// TIPIZIRANA ALOKACIJA (precizno pracenje pokazivaca)
+void *alloc_heap_typed(Heap *h, const HeapType *type)
+{
+    if (!type)
     {
-        unsigned char *payload = (unsigned char *)(void *)(cur + 1);
-        BlockHeader *split = (BlockHeader *)(void *)(payload + req);
-        split->size = remaining - sizeof(BlockHeader);
-        split->magic = BLOCK_MAGIC;
-        split->flags = BLOCK_FLAG_FREE;
-        split->next_free = NULL;
+        return NULL;
+    }
 
-        free_list_push(&h->free_list, split);
+    if (type->pointer_count == 0)
+    {
+        return alloc_one(h, type->size, 0, BLOCK_FLAG_NOSCAN, 1, NULL);
+    }
+    // HeapType ide u poslednju rec payload-a, iza objekta
+    return alloc_one(h, type->size + sizeof(void *), 0, BLOCK_FLAG_TYPED, 1, type);
+}
 
-        cur->size = req;
+// FINALIZABILNA ALOKACIJA: uvek u segmentu, pa se objekat nikad ne pomera
+void *alloc_heap_finalizable(Heap *h, size_t size_bytes, HeapFinalizer fn)
+{
+    if (!h || size_bytes == 0 || !fn)
+    {
+        return NULL;
     }
 
-    cur->flags &= ~BLOCK_FLAG_FREE;
-    cur->flags &= ~BLOCK_FLAG_MARK;
-    h->allocated_bytes += cur->size;
+    gc_safepoint(h);
+
+    size_t req = heap_align_up(size_bytes);
+    void *out = NULL;
+
+    heap_lock(h);
+    // mesto u registru se obezbedi pre alokacije, pa upis posle ne moze da padne
+    if (final_start(h) == 0 && final_reserve(h) == 0)
+    {
+        BlockHeader *cur = free_list_take(h, req, 0, 1);
+        if (cur)
+        {
+            carve_block(h, cur, req, 1, &out, BLOCK_FLAG_FINAL, 1);
+            h->finals[h->final_count].obj = out;
+            h->finals[h->final_count].fn = fn;
+            h->final_count++;
+            if (h->trace)
+            {
+                trace_alloc(h, out, size_bytes);
+            }
+        }
+    }
+    heap_unlock(h);
 
-    void *out = (void *)(cur + 1);
-    memset(out, 0, cur->size);
-    pthread_mutex_unlock(&h->lock);
     return out;
 }
 
-// OSLOBODI MEMORIJU
-void free_heap(Heap *h, void *ptr)
+// GRUPNA ALOKACIJA
+size_t alloc_heap_batch(Heap *h, size_t size_bytes, size_t n, void **out)
 {
-    if (!h || !ptr)
+    if (!h || size_bytes == 0 || n == 0 || !out)
+    {
+        return 0;
+    }
+
+    gc_safepoint(h);
+
+    size_t req = heap_align_up(size_bytes);
+    size_t done = 0;
+
+    heap_lock(h);
+
+    int immix = immix_takes(h, req, 0);
+    while (done < n)
     {
+        size_t k = 1;
+        if (immix)
+        {
+            BlockHeader *cur = immix_alloc(h, req, 0, 1);
+            if (!cur)
+            {
+                break;
+            }
+            out[done] = cur + 1;
+        }
+        else
+        {
+            BlockHeader *cur = free_list_take(h, req, 0, 1);
+            if (!cur)
+            {
+                break;
+            }
+            k = carve_block(h, cur, req, n - done, out + done, 0, 1);
+        }
+        for (size_t i = 0; h->trace && i < k; i++)
+        {
+            trace_alloc(h, out[done + i], size_bytes);
+        }
+        done += k;
+    }
+
+    heap_unlock(h);
+
+    for (size_t i = done; i < n; i++)
+    {
+        out[i] = NULL;
+    }
+    return done;
+}
+
+void free_locked(Heap *h, void *ptr)
+{
+    if (heap_contains(h, ptr) && heap_slab_of(h, ptr))
+    {
+        pool_free_locked(h, ptr);
         return;
     }
 
-    pthread_mutex_lock(&h->lock);
+    // samo pocetak bloka u segmentu ili Immix bloku; slika heap-a i regioni se ne oslobadjaju ovde
     BlockHeader *block = (BlockHeader *)ptr - 1;
-    if (block->magic != BLOCK_MAGIC)
+    if (!heap_contains(h, block) || !block_start_test(h, block))
+    {
+        return;
+    }
+    if (heap_chunk_kind(h, block) == CHUNK_IMMIX)
+    {
+        if (h->trace)
+        {
+            trace_free(h, ptr);
+        }
+        immix_free_locked(h, block);
+        return;
+    }
+    if (heap_chunk_kind(h, block) != CHUNK_SEGMENT)
     {
-        pthread_mutex_unlock(&h->lock);
         return;
     }
 
     if ((block->flags & BLOCK_FLAG_FREE) != 0)
     {
-        pthread_mutex_unlock(&h->lock);
         return;
     }
+    if (block->flags & BLOCK_FLAG_FINAL)
+    {
+        final_forget(h, ptr);
+    }
+    if (block->flags & BLOCK_FLAG_REGION)
+    {
+        region_forget_large(h, ptr);
+    }
+
+    if (h->trace)
+    {
+        trace_free(h, ptr);
+    }
 
-    block->flags |= BLOCK_FLAG_FREE;
-    block->flags &= ~BLOCK_FLAG_MARK;
+    block->flags = BLOCK_FLAG_FREE;
     if (h->allocated_bytes >= block->size)
     {
         h->allocated_bytes -= block->size;
@@ -254,6 +852,216 @@ void free_heap(Heap *h, void *ptr)
         h->allocated_bytes = 0;
     }
 
-    free_list_push(&h->free_list, block);
-    pthread_mutex_unlock(&h->lock);
+    free_list_push(free_list_of(h, block->size), block);
+}
+
+// OSLOBODI MEMORIJU
+void free_heap(Heap *h, void *ptr)
+{
+    if (!h || !ptr)
+    {
+        return;
+    }
+
+    heap_lock(h);
+    free_locked(h, ptr);
+    heap_unlock(h);
+}
+
+// GRUPNO OSLOBADJANJE
+void free_heap_batch(Heap *h, void **ptrs, size_t n)
+{
+    if (!h || !ptrs)
+    {
+        return;
+    }
+
+    heap_lock(h);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (ptrs[i])
+        {
+            free_locked(h, ptrs[i]);
+        }
+    }
+    heap_unlock(h);
+}
+
+// ------ PROMENA VELICINE -----------
+// kraj segmenta u kom je blok; blokovi se ne spajaju preko granice segmenta
+static unsigned char *segment_end_of(const Heap *h, const void *p)
+{
+    const unsigned char *x = (const unsigned char *)p;
+    for (Segment *seg = h->segments; seg; seg = seg->next)
+    {
+        if (x >= seg->mem && x < seg->mem + seg->size)
+        {
+            return seg->mem + seg->size;
+        }
+    }
+    return NULL;
+}
+
+static void free_list_unlink(Heap *h, BlockHeader *b)
+{
+    BlockHeader **head = free_list_of(h, b->size);
+    BlockHeader *prev = NULL;
+    for (BlockHeader *cur = *head; cur; cur = block_next_free(cur))
+    {
+        if (cur == b)
+        {
+            free_list_remove(head, prev, cur);
+            return;
+        }
+        prev = cur;
+    }
+}
+
+// b raste u slobodne susede iza sebe ili se skracuje; visak iza req ide u listu
+static int resize_in_place(Heap *h, BlockHeader *b, size_t req)
+{
+    unsigned char *payload = (unsigned char *)(void *)(b + 1);
+    size_t old = b->size;
+    size_t avail = old;
+
+    if (req > old)
+    {
+        unsigned char *end = segment_end_of(h, b);
+        unsigned char *cur = payload + old;
+        while (avail < req && end && cur + sizeof(BlockHeader) <= end)
+        {
+            BlockHeader *n = (BlockHeader *)(void *)cur;
+            if (!block_start_test(h, n) || !(n->flags & BLOCK_FLAG_FREE))
+            {
+                break;
+            }
+            avail += sizeof(BlockHeader) + n->size;
+            cur += sizeof(BlockHeader) + n->size;
+        }
+        if (avail < req)
+        {
+            return 0;
+        }
+
+        for (cur = payload + old; cur < payload + avail;)
+        {
+            BlockHeader *n = (BlockHeader *)(void *)cur;
+            cur += sizeof(BlockHeader) + n->size;
+            free_list_unlink(h, n);
+            block_reclaim(h, n);
+            block_start_clear(h, n);
+        }
+        memset(payload + old, 0, avail - old);
+        b->size = avail;
+    }
+
+    size_t remaining = b->size - req;
+    if (remaining > sizeof(BlockHeader) + HEAP_ALIGNMENT)
+    {
+        BlockHeader *split = (BlockHeader *)(void *)(payload + req);
+        split->size = remaining - sizeof(BlockHeader);
+        split->flags = BLOCK_FLAG_FREE;
+        block_start_set(h, split);
+        free_list_push(free_list_of(h, split->size), split);
+        b->size = req;
+    }
+    else if (req < old)
+    {
+        // ostatak ostaje u bloku; stari pokazivaci u njemu ne smeju drzati objekte
+        memset(payload + req, 0, b->size - req);
+    }
+
+    if (b->size >= old)
+    {
+        h->allocated_bytes += b->size - old;
+    }
+    else
+    {
+        size_t dec = old - b->size;
+        h->allocated_bytes = (h->allocated_bytes >= dec) ? h->allocated_bytes - dec : 0;
+    }
+    return 1;
+}
+
+// PROMENA VELICINE (u mestu kad moze, inace nov blok + kopija)
+// objekti regiona, slike heap-a i tipizirani objekti se ne menjaju (NULL)
+void *realloc_heap(Heap *h, void *ptr, size_t size_bytes)
+{
+    if (!h)
+    {
+        return NULL;
+    }
+    if (!ptr)
+    {
+        return alloc_heap(h, size_bytes);
+    }
+    if (size_bytes == 0)
+    {
+        free_heap(h, ptr);
+        return NULL;
+    }
+
+    gc_safepoint(h);
+
+    size_t req = heap_align_up(size_bytes);
+    size_t old_size = 0;
+    uint32_t flags = 0;
+
+    heap_lock(h);
+
+    Slab *s = heap_contains(h, ptr) ? heap_slab_of(h, ptr) : NULL;
+    if (s)
+    {
+        if (slab_index(s, ptr) == (size_t)-1)
+        {
+            heap_unlock(h);
+            return NULL;
+        }
+        old_size = s->obj_size;
+        if (req <= old_size)
+        {
+            heap_unlock(h);
+            return ptr;
+        }
+    }
+    else
+    {
+        BlockHeader *b = (BlockHeader *)ptr - 1;
+        unsigned char kind = heap_contains(h, b) ? heap_chunk_kind(h, b) : CHUNK_FREE;
+        if ((kind != CHUNK_SEGMENT && kind != CHUNK_IMMIX) || !block_start_test(h, b) ||
+            (b->flags & (BLOCK_FLAG_FREE | BLOCK_FLAG_TYPED | BLOCK_FLAG_FINAL | BLOCK_FLAG_REGION)))
+        {
+            heap_unlock(h);
+            return NULL;
+        }
+
+        // Immix objekat ne raste u mestu; manji zahtev zadrzava isti blok
+        if (kind == CHUNK_IMMIX && req <= b->size)
+        {
+            heap_unlock(h);
+            return ptr;
+        }
+        if (kind == CHUNK_SEGMENT && resize_in_place(h, b, req))
+        {
+            if (h->trace)
+            {
+                trace_free(h, ptr);
+                trace_alloc(h, ptr, size_bytes);
+            }
+            heap_unlock(h);
+            return ptr;
+        }
+        old_size = b->size;
+        flags = b->flags & BLOCK_FLAG_NOSCAN;
+    }
+
+    heap_unlock(h);
+
+    void *np = alloc_one(h, size_bytes, 0, flags, 1, NULL);
+    if (np)
+    {
+        memcpy(np, ptr, old_size < req ? old_size : req);
+        free_heap(h, ptr);
+    }
+    return np;
 }
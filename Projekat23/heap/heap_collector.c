@@ -0,0 +1,214 @@
+#include "heap_state.h"
+#include <stdlib.h>
+
+// ------ NIT SAKUPLJACA -----------
+static void *collector_main(void *arg)
+{
+    Heap *h = (Heap *)arg;
+
+    pthread_mutex_lock(&h->gc_req_lock);
+    for (;;)
+    {
+        while (!h->collector_stop && h->gc_cycle_requested == h->gc_cycle_started)
+        {
+            pthread_cond_wait(&h->gc_req_cond, &h->gc_req_lock);
+        }
+        if (h->collector_stop)
+        {
+            break;
+        }
+
+        h->gc_cycle_started = h->gc_cycle_requested;
+        pthread_mutex_unlock(&h->gc_req_lock);
+
+        collect_now(h);
+
+        // try_alloc_heap je promasio: memorija se dodaje ovde, van puta alokacije
+        size_t miss = atomic_exchange(&h->try_miss_bytes, 0);
+        if (miss > 0)
+        {
+            heap_refill(h, miss);
+        }
+
+        pthread_mutex_lock(&h->gc_req_lock);
+        h->gc_cycle_done = h->gc_cycle_started;
+        // meka granica predjena tokom ovog ciklusa (evakuacija, dopuna): niti su vec
+        // pustene, pa sledeci ciklus moze da se trazi ovde
+        if (atomic_exchange(&h->pressure_collect, 0) && h->gc_cycle_requested == h->gc_cycle_started)
+        {
+            h->gc_cycle_requested = h->gc_cycle_started + 1;
+        }
+        pthread_cond_broadcast(&h->gc_req_cond);
+
+        // tek posle objave ciklusa: waiter-i ne cekaju pozive, a poziv sme da zove collect_heap
+        pthread_mutex_unlock(&h->gc_req_lock);
+        heap_pressure_run(h);
+        pthread_mutex_lock(&h->gc_req_lock);
+    }
+    pthread_mutex_unlock(&h->gc_req_lock);
+
+    return NULL;
+}
+
+int collector_start(Heap *h)
+{
+    if (pthread_mutex_init(&h->gc_req_lock, NULL) != 0)
+    {
+        return -1;
+    }
+    if (pthread_cond_init(&h->gc_req_cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&h->gc_req_lock);
+        return -1;
+    }
+
+    h->collector_stop = 0;
+    h->gc_cycle_requested = 0;
+    h->gc_cycle_started = 0;
+    h->gc_cycle_done = 0;
+
+    if (pthread_create(&h->collector, NULL, collector_main, h) != 0)
+    {
+        pthread_cond_destroy(&h->gc_req_cond);
+        pthread_mutex_destroy(&h->gc_req_lock);
+        return -1;
+    }
+    return 0;
+}
+
+void collector_stop(Heap *h)
+{
+    pthread_mutex_lock(&h->gc_req_lock);
+    h->collector_stop = 1;
+    pthread_cond_broadcast(&h->gc_req_cond);
+    pthread_mutex_unlock(&h->gc_req_lock);
+
+    pthread_join(h->collector, NULL);
+
+    pthread_cond_destroy(&h->gc_req_cond);
+    pthread_mutex_destroy(&h->gc_req_lock);
+}
+
+// jednonitni heap nema nit sakupljaca: ciklus radi odmah, na pozivaocu
+static GcTicket collect_inline(Heap *h)
+{
+    ThreadInfo *ti = thread_current(h);
+    if (ti)
+    {
+        thread_save_context(ti);
+    }
+
+    collect_now(h);
+
+    size_t miss = atomic_exchange(&h->try_miss_bytes, 0);
+    if (miss > 0)
+    {
+        heap_refill(h, miss);
+    }
+
+    // ciklus je gotov pre poziva i finalizatora; ugnjezdeni collect_heap je sledeci ciklus
+    h->gc_cycle_done++;
+    h->gc_cycle_started = h->gc_cycle_requested = h->gc_cycle_done;
+    GcTicket ticket = h->gc_cycle_done;
+
+    heap_pressure_run(h);
+    final_run_pending(h);
+    return ticket;
+}
+
+// ZAHTEV ZA GC (zahtevi koji stignu pre pocetka ciklusa se spajaju)
+GcTicket collect_heap_async(Heap *h)
+{
+    if (!h)
+    {
+        return 0;
+    }
+    if (heap_single(h))
+    {
+        return collect_inline(h);
+    }
+
+    pthread_mutex_lock(&h->gc_req_lock);
+    if (h->gc_cycle_requested == h->gc_cycle_started)
+    {
+        h->gc_cycle_requested = h->gc_cycle_started + 1;
+        pthread_cond_broadcast(&h->gc_req_cond);
+    }
+    GcTicket ticket = h->gc_cycle_requested;
+    pthread_mutex_unlock(&h->gc_req_lock);
+
+    return ticket;
+}
+
+// zahtev bez blokiranja (try_alloc_heap); ako je lock zahteva zauzet, promasaj ostaje
+// zabelezen u try_miss_bytes i obradjuje se uz sledeci ciklus
+void collect_request_nowait(Heap *h)
+{
+    if (heap_single(h) || pthread_mutex_trylock(&h->gc_req_lock) != 0)
+    {
+        return;
+    }
+    if (h->gc_cycle_requested == h->gc_cycle_started)
+    {
+        h->gc_cycle_requested = h->gc_cycle_started + 1;
+        pthread_cond_broadcast(&h->gc_req_cond);
+    }
+    pthread_mutex_unlock(&h->gc_req_lock);
+}
+
+int collect_heap_done(Heap *h, GcTicket ticket)
+{
+    if (!h)
+    {
+        return 1;
+    }
+    if (heap_single(h))
+    {
+        return h->gc_cycle_done >= ticket;
+    }
+
+    pthread_mutex_lock(&h->gc_req_lock);
+    int done = h->gc_cycle_done >= ticket;
+    pthread_mutex_unlock(&h->gc_req_lock);
+
+    return done;
+}
+
+void collect_heap_wait(Heap *h, GcTicket ticket)
+{
+    if (!h || heap_single(h))
+    {
+        return;
+    }
+    // povratni poziv pritiska na niti sakupljaca: ciklus moze pokrenuti samo ona
+    if (pthread_equal(pthread_self(), h->collector))
+    {
+        return;
+    }
+
+    // registrovana nit ceka kao parkirana, inace bi blokirala sopstveni ciklus
+    ThreadInfo *ti = thread_current(h);
+    if (ti)
+    {
+        thread_save_context(ti);
+        atomic_store(&ti->status, THREAD_PARKED);
+    }
+
+    pthread_mutex_lock(&h->gc_req_lock);
+    while (h->gc_cycle_done < ticket)
+    {
+        pthread_cond_wait(&h->gc_req_cond, &h->gc_req_lock);
+    }
+    pthread_mutex_unlock(&h->gc_req_lock);
+
+    if (ti)
+    {
+        thread_unpark(h, ti);
+    }
+}
+
+//------ GARBAJE COLLECTOR ------
+void collect_heap(Heap *h)
+{
+    collect_heap_wait(h, collect_heap_async(h));
+}
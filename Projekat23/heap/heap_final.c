@@ -0,0 +1,338 @@
+#include "heap_state.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static int entries_grow(FinalEntry **v, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+    {
+        return 0;
+    }
+
+    size_t new_cap = (*cap == 0) ? 64 : *cap * 2;
+    while (new_cap < need)
+    {
+        new_cap *= 2;
+    }
+    FinalEntry *nv = (FinalEntry *)realloc(*v, new_cap * sizeof(FinalEntry));
+    if (!nv)
+    {
+        return -1;
+    }
+    *v = nv;
+    *cap = new_cap;
+    return 0;
+}
+
+// red i batch puni GC dok su niti zaustavljene: neka od njih moze drzati malloc
+// lock, pa oba niza zive u mmap memoriji (kao pomocna memorija sakupljaca)
+static int queue_grow(FinalEntry **v, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+    {
+        return 0;
+    }
+
+    size_t new_cap = (*cap == 0) ? 256 : *cap * 2;
+    while (new_cap < need)
+    {
+        new_cap *= 2;
+    }
+    void *nv = mmap(NULL, new_cap * sizeof(FinalEntry), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (nv == MAP_FAILED)
+    {
+        return -1;
+    }
+    if (*v)
+    {
+        memcpy(nv, *v, *cap * sizeof(FinalEntry));
+        munmap(*v, *cap * sizeof(FinalEntry));
+    }
+    *v = (FinalEntry *)nv;
+    *cap = new_cap;
+    return 0;
+}
+
+static void queue_free(FinalEntry *v, size_t cap)
+{
+    if (v)
+    {
+        munmap(v, cap * sizeof(FinalEntry));
+    }
+}
+
+// ------ FINAL_LOCK -----------
+// pravilo iz heap_state.h: RUNNING nit bez lock-a heap-a ne sme da ceka na final_lock.
+// Lock heap-a se proverava prvi: thread_current bi ga inace uzeo jos jednom
+void final_lock_take(Heap *h)
+{
+#ifndef NDEBUG
+    if (!heap_single(h) && heap_lock_owner != h)
+    {
+        ThreadInfo *ti = thread_current(h);
+        assert(!ti || atomic_load(&ti->status) != THREAD_RUNNING);
+    }
+#endif
+    pthread_mutex_lock(&h->final_lock);
+}
+
+// GC uzima final_lock tokom pauze: registrovana nit ga drzi samo u native stanju
+// (ili pod lock-om heap-a), inace bi je signal zaustavio sa lock-om u ruci
+static void final_lock_native(Heap *h)
+{
+    thread_enter_native(h);
+    final_lock_take(h);
+}
+
+static void final_unlock_native(Heap *h)
+{
+    pthread_mutex_unlock(&h->final_lock);
+    thread_leave_native(h);
+}
+
+// ------ BATCH -----------
+// pod final_lock ceo red postaje batch; fn se zovu van lock-a, a GC za to vreme
+// markira batch, pa objekti ostaju na heap-u dok se fn ne zavrse
+static void batch_take_locked(Heap *h)
+{
+    FinalEntry *v = h->final_batch;
+    size_t cap = h->final_batch_cap;
+    h->final_batch = h->final_queue;
+    h->final_batch_cap = h->final_queue_cap;
+    h->final_batch_len = h->final_queue_len;
+    h->final_queue = v;
+    h->final_queue_cap = cap;
+    h->final_queue_len = 0;
+}
+
+static void batch_run(Heap *h)
+{
+    for (size_t i = 0; i < h->final_batch_len; i++)
+    {
+        h->final_batch[i].fn(h->final_batch[i].obj);
+    }
+}
+
+static void batch_done_locked(Heap *h)
+{
+    h->final_batch_len = 0;
+    pthread_cond_broadcast(&h->final_cond);
+}
+
+// ------ NIT FINALIZATORA -----------
+// registrovana nit: fn mogu da alociraju i upisuju u objekte kao i svaka druga nit.
+// Dok ceka na red je u native stanju, pa ne zadrzava GC.
+static void *finalizer_main(void *arg)
+{
+    Heap *h = (Heap *)arg;
+
+    thread_register(h);
+    for (;;)
+    {
+        thread_enter_native(h);
+        final_lock_take(h);
+        batch_done_locked(h);
+        while (!h->finalizer_stop && h->final_queue_len == 0)
+        {
+            pthread_cond_wait(&h->final_cond, &h->final_lock);
+        }
+        // pri gasenju se red prvo isprazni
+        if (h->final_queue_len == 0)
+        {
+            pthread_mutex_unlock(&h->final_lock);
+            break;
+        }
+        batch_take_locked(h);
+        pthread_mutex_unlock(&h->final_lock);
+        thread_leave_native(h);
+
+        batch_run(h);
+    }
+    thread_leave_native(h);
+    thread_unregister(h);
+
+    return NULL;
+}
+
+// pod lock-om heap-a; jednonitni heap nema nit, red prazni collect_heap
+int final_start(Heap *h)
+{
+    if (h->final_started)
+    {
+        return 0;
+    }
+
+    if (pthread_mutex_init(&h->final_lock, NULL) != 0)
+    {
+        return -1;
+    }
+    if (pthread_cond_init(&h->final_cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&h->final_lock);
+        return -1;
+    }
+
+    h->finalizer_stop = 0;
+    h->final_running = 0;
+    if (!heap_single(h) && pthread_create(&h->finalizer, NULL, finalizer_main, h) != 0)
+    {
+        pthread_cond_destroy(&h->final_cond);
+        pthread_mutex_destroy(&h->final_lock);
+        return -1;
+    }
+    h->final_started = 1;
+    return 0;
+}
+
+// zove destroy_heap pre zaustavljanja sakupljaca: fn smeju da alociraju i zovu
+// collect_heap. Vec uredjeni fn se izvrse; ono sto GC uredi posle izlaska niti
+// izvrsava pozivalac, dok pod lock-om heap-a red ne ostane prazan
+void final_stop(Heap *h)
+{
+    if (h->final_started)
+    {
+        if (!heap_single(h))
+        {
+            final_lock_native(h);
+            h->finalizer_stop = 1;
+            pthread_cond_broadcast(&h->final_cond);
+            final_unlock_native(h);
+
+            pthread_join(h->finalizer, NULL);
+        }
+
+        for (;;)
+        {
+            final_run_pending(h);
+
+            heap_lock(h);
+            final_lock_take(h);
+            int empty = (h->final_queue_len == 0);
+            pthread_mutex_unlock(&h->final_lock);
+            if (empty)
+            {
+                // GC (pod lock-om heap-a) od sada ne dira red
+                h->final_started = 0;
+                heap_unlock(h);
+                break;
+            }
+            heap_unlock(h);
+        }
+
+        pthread_cond_destroy(&h->final_cond);
+        pthread_mutex_destroy(&h->final_lock);
+    }
+
+    free(h->finals);
+    queue_free(h->final_queue, h->final_queue_cap);
+    queue_free(h->final_batch, h->final_batch_cap);
+    h->finals = h->final_queue = h->final_batch = NULL;
+    h->final_count = h->final_cap = 0;
+    h->final_queue_len = h->final_queue_cap = 0;
+    h->final_batch_len = h->final_batch_cap = 0;
+}
+
+// ------ REGISTAR (pod lock-om heap-a) -----------
+int final_reserve(Heap *h)
+{
+    return entries_grow(&h->finals, &h->final_cap, h->final_count + 1);
+}
+
+// free_heap nad finalizabilnim objektom: fn se vise ne zove
+void final_forget(Heap *h, void *obj)
+{
+    for (size_t i = 0; i < h->final_count; i++)
+    {
+        if (h->finals[i].obj == obj)
+        {
+            h->finals[i] = h->finals[--h->final_count];
+            return;
+        }
+    }
+}
+
+// ------ RED (pod final_lock, zove ga GC) -----------
+int final_enqueue(Heap *h, FinalEntry e)
+{
+    if (queue_grow(&h->final_queue, &h->final_queue_cap, h->final_queue_len + 1) != 0)
+    {
+        return -1;
+    }
+    h->final_queue[h->final_queue_len++] = e;
+    return 0;
+}
+
+void final_notify(Heap *h)
+{
+    pthread_cond_broadcast(&h->final_cond);
+}
+
+// jednonitni heap: red se izvrsava na pozivaocu, posle ciklusa. fn koji alocira ili
+// zove collect_heap ponovo ulazi ovde; ugnjezdeni poziv se vraca, a novi unosi ostaju
+// u redu za spoljnu petlju (inace bi zamena nizova prekinula batch u toku)
+void final_run_pending(Heap *h)
+{
+    if (!h->final_started)
+    {
+        return;
+    }
+
+    final_lock_native(h);
+    if (h->final_running)
+    {
+        final_unlock_native(h);
+        return;
+    }
+    h->final_running = 1;
+    h->final_runner = pthread_self();
+    while (h->final_queue_len > 0)
+    {
+        batch_take_locked(h);
+        final_unlock_native(h);
+        batch_run(h);
+        final_lock_native(h);
+        batch_done_locked(h);
+    }
+    h->final_running = 0;
+    final_unlock_native(h);
+}
+
+// ------ CEKANJE -----------
+// ceka dok se ne izvrse svi fn koje je GC do sada uredio
+void heap_finalize_wait(Heap *h)
+{
+    if (!h)
+    {
+        return;
+    }
+
+    heap_lock(h);
+    int started = h->final_started;
+    heap_unlock(h);
+    if (!started)
+    {
+        return;
+    }
+    // jednonitni heap: ugnjezden poziv iz fn se vraca u final_run_pending
+    if (heap_single(h))
+    {
+        final_run_pending(h);
+        return;
+    }
+    // fn koji ceka sopstveni batch bi cekao zauvek
+    if (pthread_equal(pthread_self(), h->finalizer))
+    {
+        return;
+    }
+
+    // registrovana nit ceka kao u native stanju, da ne blokira GC
+    final_lock_native(h);
+    int self = h->final_running && pthread_equal(pthread_self(), h->final_runner);
+    while (!self && (h->final_queue_len > 0 || h->final_batch_len > 0))
+    {
+        pthread_cond_wait(&h->final_cond, &h->final_lock);
+    }
+    final_unlock_native(h);
+}
@@ -1,49 +1,36 @@
 #include "heap_state.h"
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <sys/mman.h>
 
 static void free_list_push(BlockHeader **head, BlockHeader *block)
 {
-    block->next_free = *head;
+    block_set_next_free(block, *head);
     *head = block;
 }
 
-
-static int ptr_in_segment(const Segment *seg, const void *p)
-{
-    size_t start = (size_t)(const void *)seg->mem;
-    size_t end = start + seg->size;
-    size_t x = (size_t)p;
-    return (x >= start) && (x < end);
-}
-
 static BlockHeader *block_from_payload(Heap *h, void *payload)
 {
-    if (!h || !payload)
+    if (!h || (size_t)payload < sizeof(BlockHeader))
     {
         return NULL;
     }
 
     BlockHeader *b = ((BlockHeader *)payload) - 1;
-
-    Segment *seg = h->segments;
-    int in_segment = 0;
-    while (seg)
+    if (!heap_contains(h, b) || !heap_contains(h, payload))
     {
-        if (ptr_in_segment(seg, (void *)b))
-        {
-            in_segment = 1;
-            break;
-        }
-        seg = seg->next;
+        return NULL;
     }
-
-    if (!in_segment)
+    // slabovi, regioni i slobodni chunkovi nemaju obicne blokove
+    unsigned char kind = heap_chunk_kind(h, payload);
+    if ((kind != CHUNK_SEGMENT && kind != CHUNK_IMMIX) || heap_chunk_kind(h, b) != kind)
     {
         return NULL;
     }
 
-    if (b->magic != BLOCK_MAGIC)
+    // unutrasnji pokazivac: b nije pocetak bloka
+    if (!block_start_test(h, b))
     {
         return NULL;
     }
@@ -69,7 +56,7 @@ static void for_each_block(Heap *h, block_visit_fn fn, void *ctx)
         {
             BlockHeader *b = (BlockHeader *)(void *)cur;
 
-            if (b->magic != BLOCK_MAGIC)
+            if (!block_start_test(h, b))
             {
                 break;
             }
@@ -88,6 +75,37 @@ static void for_each_block(Heap *h, block_visit_fn fn, void *ctx)
     }
 }
 
+// ------ POMOCNA MEMORIJA SAKUPLJACA -----------
+// dok su niti zaustavljene neka od njih moze drzati malloc lock, pa ciklus ne koristi malloc
+static void *scratch_alloc(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+static void scratch_free(void *p, size_t bytes)
+{
+    if (p)
+    {
+        munmap(p, bytes);
+    }
+}
+
+static void *scratch_grow(void *p, size_t old_bytes, size_t new_bytes)
+{
+    void *np = scratch_alloc(new_bytes);
+    if (!np)
+    {
+        return NULL;
+    }
+    if (p)
+    {
+        memcpy(np, p, old_bytes);
+        scratch_free(p, old_bytes);
+    }
+    return np;
+}
+
 // ------ MARK -----------
 typedef struct MarkStack
 {
@@ -98,15 +116,15 @@ typedef struct MarkStack
 
 static int markstack_init(MarkStack *st)
 {
-    st->cap = 128;
+    st->cap = 512;
     st->len = 0;
-    st->items = (BlockHeader **)malloc(st->cap * sizeof(BlockHeader *));
+    st->items = (BlockHeader **)scratch_alloc(st->cap * sizeof(BlockHeader *));
     return st->items ? 0 : -1;
 }
 
 static void markstack_destroy(MarkStack *st)
 {
-    free(st->items);
+    scratch_free(st->items, st->cap * sizeof(BlockHeader *));
     st->items = NULL;
     st->len = 0;
     st->cap = 0;
@@ -117,7 +135,8 @@ static void markstack_push(MarkStack *st, BlockHeader *b)
     if (st->len == st->cap)
     {
         size_t new_cap = st->cap * 2;
-        BlockHeader **ns = (BlockHeader **)realloc(st->items, new_cap * sizeof(BlockHeader *));
+        BlockHeader **ns = (BlockHeader **)scratch_grow(st->items, st->cap * sizeof(BlockHeader *),
+                                                          new_cap * sizeof(BlockHeader *));
         if (!ns)
         {
             return;
@@ -137,23 +156,194 @@ static BlockHeader *markstack_pop(MarkStack *st)
     return st->items[--st->len];
 }
 
-static void try_mark(Heap *h, MarkStack *st, void *candidate)
+// objekat iz slaba ide na mark stek sa oznakom u najnizem bitu (nema BlockHeader)
+#define MARK_SLAB_TAG ((uintptr_t)1)
+
+static void try_mark_slab(MarkStack *st, Slab *s, void *candidate)
 {
+    size_t i = slab_index(s, candidate);
+    if (i == (size_t)-1)
+    {
+        return;
+    }
+
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    if (s->mark_bits[i / 64] & bit)
+    {
+        return;
+    }
+    s->mark_bits[i / 64] |= bit;
+
+    markstack_push(st, (BlockHeader *)(void *)((uintptr_t)candidate | MARK_SLAB_TAG));
+}
+
+// precise: referenca iz korena ili polja tipiziranog objekta, pa Immix sme da pomeri cilj
+static void mark_ref(Heap *h, MarkStack *st, void *candidate, int precise)
+{
+    if (!heap_contains(h, candidate))
+    {
+        return;
+    }
+
+    Slab *s = heap_slab_of(h, candidate);
+    if (s)
+    {
+        try_mark_slab(st, s, candidate);
+        return;
+    }
+
     BlockHeader *b = block_from_payload(h, candidate);
     if (!b)
     {
         return;
     }
 
+    ImmixBlock *blk = (heap_chunk_kind(h, b) == CHUNK_IMMIX) ? immix_block_of(h, b) : NULL;
+    if (blk && !precise && blk->evacuate)
+    {
+        b->flags |= BLOCK_FLAG_PINNED;
+    }
+
     if (b->flags & BLOCK_FLAG_MARK)
     {
         return;
     }
     b->flags |= BLOCK_FLAG_MARK;
+    if (blk)
+    {
+        immix_mark_lines(blk, b);
+    }
 
     markstack_push(st, b);
 }
 
+static void try_mark(Heap *h, MarkStack *st, void *candidate)
+{
+    mark_ref(h, st, candidate, 0);
+}
+
+static void mark_drain(Heap *h, MarkStack *st)
+{
+    BlockHeader *b;
+    while ((b = markstack_pop(st)) != NULL)
+    {
+        if ((uintptr_t)b & MARK_SLAB_TAG)
+        {
+            size_t *obj = (size_t *)(void *)((uintptr_t)b & ~MARK_SLAB_TAG);
+            size_t n = heap_slab_of(h, obj)->obj_size / sizeof(size_t);
+            for (size_t k = 0; k < n; k++)
+            {
+                try_mark(h, st, (void *)obj[k]);
+            }
+            continue;
+        }
+
+        if (b->flags & BLOCK_FLAG_NOSCAN)
+        {
+            continue;
+        }
+
+        if (b->flags & BLOCK_FLAG_TYPED)
+        {
+            unsigned char *payload = (unsigned char *)(void *)(b + 1);
+            const HeapType *type = block_type(b);
+            for (size_t k = 0; k < type->pointer_count; k++)
+            {
+                mark_ref(h, st, *(void **)(void *)(payload + type->pointer_offsets[k]), 1);
+            }
+            continue;
+        }
+
+        size_t *words = (size_t *)(void *)(b + 1);
+        size_t n = b->size / sizeof(size_t);
+
+        for (size_t k = 0; k < n; k++)
+        {
+            void *cand = (void *)words[k];
+            try_mark(h, st, cand);
+        }
+    }
+}
+
+// konzervativni scan opsega (stek niti)
+HEAP_NO_SANITIZE_ADDRESS
+static void scan_range(Heap *h, MarkStack *st, void *lo, void *hi)
+{
+    size_t *p = (size_t *)lo;
+    size_t *end = (size_t *)hi;
+
+    for (; p < end; p++)
+    {
+        try_mark(h, st, (void *)(*p));
+    }
+}
+
+// objekat koji nije na heap-u smatra se uvek zivim
+static int is_live(Heap *h, void *p)
+{
+    if (heap_contains(h, p) && heap_slab_of(h, p))
+    {
+        Slab *s = heap_slab_of(h, p);
+        size_t i = slab_index(s, p);
+        return i == (size_t)-1 || (s->mark_bits[i / 64] & ((uint64_t)1 << (i % 64)));
+    }
+
+    BlockHeader *b = block_from_payload(h, p);
+    return !b || (b->flags & BLOCK_FLAG_MARK);
+}
+
+// ------ EFEMERONI I SLABE REFERENCE -----------
+static void mark_ephemerons(Heap *h, MarkStack *st)
+{
+    int progress;
+    do
+    {
+        progress = 0;
+        for (EphemeronTable *t = h->ephemerons; t; t = t->next)
+        {
+            for (size_t i = 0; i < t->capacity; i++)
+            {
+                EphemeronEntry *e = &t->entries[i];
+                if (!ephemeron_entry_live(e) || !is_live(h, e->key))
+                {
+                    continue;
+                }
+                BlockHeader *vb = block_from_payload(h, e->value);
+                if (vb && !(vb->flags & BLOCK_FLAG_MARK))
+                {
+                    try_mark(h, st, e->value);
+                    progress = 1;
+                }
+            }
+        }
+        mark_drain(h, st);
+    } while (progress);
+}
+
+static void clear_weak(Heap *h)
+{
+    for (EphemeronTable *t = h->ephemerons; t; t = t->next)
+    {
+        for (size_t i = 0; i < t->capacity; i++)
+        {
+            EphemeronEntry *e = &t->entries[i];
+            if (ephemeron_entry_live(e) && !is_live(h, e->key))
+            {
+                ephemeron_entry_clear(t, e);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < h->weak.capacity; i++)
+    {
+        void **slot = h->weak.slots[i];
+        if (slotset_live(slot) && *slot && !is_live(h, *slot))
+        {
+            *slot = NULL;
+        }
+    }
+}
+
 
 // -------- SWEEP -----------
 static void sweep(Heap *hh, Segment *seg, BlockHeader *b, void *ctx)
@@ -174,104 +364,274 @@ static void sweep(Heap *hh, Segment *seg, BlockHeader *b, void *ctx)
         return;
     }
 
-    b->flags |= BLOCK_FLAG_FREE;
+    if (hh->trace)
+    {
+        trace_gc_free(hh, b + 1);
+    }
+
+    b->flags = BLOCK_FLAG_FREE;
 
     if (hh->allocated_bytes >= b->size)
         hh->allocated_bytes -= b->size;
     else
         hh->allocated_bytes = 0;
 
-    free_list_push(&hh->free_list, b);
+    free_list_push(free_list_of(hh, b->size), b);
     if (freed)
     {
         (*freed)++;
     }
 }
 
-//------ GARBAJE COLLECTOR ------
-void collect_heap(Heap *h)
+// SWEEP SLABOVA: alloc &= mark, po 64 objekta odjednom
+static void sweep_slabs(Heap *h)
 {
-    if (!h)
+    for (HeapPool *p = h->pools; p; p = p->next)
     {
-        return;
+        for (Slab *s = p->slabs; s; s = s->next)
+        {
+            size_t dead = 0;
+            for (size_t w = 0; w < s->words; w++)
+            {
+                dead += (size_t)__builtin_popcountll(s->alloc_bits[w] & ~s->mark_bits[w]);
+                s->alloc_bits[w] &= s->mark_bits[w];
+                s->mark_bits[w] = 0;
+            }
+            if (dead == 0)
+            {
+                continue;
+            }
+
+            s->free_count += dead;
+            size_t bytes = dead * s->obj_size;
+            h->allocated_bytes = (h->allocated_bytes >= bytes) ? h->allocated_bytes - bytes : 0;
+            if (!s->in_partial)
+            {
+                s->next_partial = p->partial;
+                p->partial = s;
+                s->in_partial = 1;
+            }
+        }
     }
+}
 
-    pthread_mutex_lock(&h->lock);
-    h->gc_requested = 1;
+// objekti aktivnih regiona su koreni dok region traje
+static void mark_regions(Heap *h, MarkStack *st)
+{
+    for (HeapRegion *r = h->regions; r; r = r->next)
+    {
+        for (RegionChunk *c = r->chunks; c; c = c->next)
+        {
+            unsigned char *cur = (unsigned char *)(void *)c + heap_align_up(sizeof(RegionChunk));
+            while (cur < c->top)
+            {
+                BlockHeader *b = (BlockHeader *)(void *)cur;
+                scan_range(h, st, b + 1, (unsigned char *)(void *)(b + 1) + b->size);
+                cur += sizeof(BlockHeader) + b->size;
+            }
+        }
+        for (size_t i = 0; i < r->large_count; i++)
+        {
+            try_mark(h, st, r->large[i]);
+        }
+    }
+}
 
-    MarkStack st;
-    if (markstack_init(&st) != 0)
+// ------ FINALIZACIJA -----------
+// nedostizni finalizabilni objekti prelaze u red; red i batch u toku se markiraju,
+// pa oni i sve na sta pokazuju prezive ovaj ciklus. Slabe reference su vec ociscene.
+static void mark_finalizable(Heap *h, MarkStack *st)
+{
+    if (!h->final_started)
     {
-        pthread_mutex_unlock(&h->lock);
         return;
     }
 
-    for (size_t i = 0; i < h->roots_count; i++)
+    final_lock_take(h);
+    size_t queued = h->final_queue_len;
+    size_t k = 0;
+    for (size_t i = 0; i < h->final_count; i++)
     {
-        void **slot = h->roots[i];
-        if (!slot)
+        FinalEntry e = h->finals[i];
+        if (is_live(h, e.obj))
         {
-            continue;
+            h->finals[k++] = e;
+        }
+        else if (final_enqueue(h, e) != 0)
+        {
+            // nema mesta u redu: objekat ostaje u registru do sledeceg ciklusa
+            h->finals[k++] = e;
+            try_mark(h, st, e.obj);
         }
-        try_mark(h, &st, *slot);
     }
+    h->final_count = k;
 
-    ThreadInfo *ti = h->threads;
-    while (ti)
+    for (size_t i = 0; i < h->final_queue_len; i++)
     {
-        if (ti->sp)
+        try_mark(h, st, h->final_queue[i].obj);
+    }
+    for (size_t i = 0; i < h->final_batch_len; i++)
+    {
+        try_mark(h, st, h->final_batch[i].obj);
+    }
+    if (h->final_queue_len > queued)
+    {
+        final_notify(h);
+    }
+    pthread_mutex_unlock(&h->final_lock);
+
+    mark_drain(h, st);
+}
+
+// ------ OPSEZI ZA SKENIRANJE -----------
+// reference iz opsega su dvosmislene kao i sa steka niti (Immix ih pinuje)
+static void mark_scan_ranges(Heap *h, MarkStack *st)
+{
+    for (size_t i = 0; i < h->scan_range_count; i++)
+    {
+        HeapScanRange *r = h->scan_ranges[i];
+        unsigned char *lo = (unsigned char *)r->lo;
+        unsigned char *hi = (unsigned char *)r->hi;
+        unsigned char *from = (unsigned char *)atomic_load_explicit(&r->from, memory_order_acquire);
+        if (!from)
         {
-            size_t *p = (size_t *)ti->sp;
-            size_t *end = (size_t *)ti->stack_hi;
+            continue;
+        }
 
-            for (; p < end; p++)
+        // fiber koji upravo radi: sacuvani from je zastareo, vazi sp niti
+        for (ThreadInfo *ti = h->threads; ti; ti = ti->next)
+        {
+            unsigned char *sp = (unsigned char *)ti->sp;
+            if (sp >= lo && sp < hi)
             {
-                try_mark(h, &st, (void *)(*p));
+                from = sp;
+                break;
             }
         }
-        ti = ti->next;
+
+        if (from < lo)
+        {
+            from = lo;
+        }
+        from = (unsigned char *)(((uintptr_t)from + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1));
+        if (from < hi)
+        {
+            scan_range(h, st, from, hi);
+        }
     }
+}
 
-    BlockHeader *b;
-    while ((b = markstack_pop(&st)) != NULL)
+//------ GARBAJE COLLECTOR (jedan ciklus) ------
+void collect_now(Heap *h)
+{
+    if (!h)
     {
-        size_t *words = (size_t *)(void *)(b + 1);
-        size_t n = b->size / sizeof(size_t);
+        return;
+    }
 
-        for (size_t k = 0; k < n; k++)
+    MarkStack st;
+    if (markstack_init(&st) != 0)
+    {
+        return;
+    }
+
+    // lock se drzi do kraja ciklusa: nit koja ga ceka je vec bezbedna
+    heap_lock(h);
+    atomic_store(&h->gc_requested, 1);
+    if (!heap_single(h) && threads_suspend(h) != 0)
+    {
+        // nit se nije zaustavila: bez njenog steka ciklus ne bi bio ispravan
+        atomic_store(&h->gc_requested, 0);
+        heap_unlock(h);
+        markstack_destroy(&st);
+        return;
+    }
+    if (h->immix_blocks)
+    {
+        immix_prepare(h);
+    }
+
+    pthread_t self = pthread_self();
+
+    for (size_t i = 0; i < h->roots.capacity; i++)
+    {
+        void **slot = h->roots.slots[i];
+        if (!slotset_live(slot))
         {
-            void *cand = (void *)words[k];
-            try_mark(h, &st, cand);
+            continue;
         }
+        mark_ref(h, &st, *slot, 1);
     }
 
+    for (size_t i = 0; i < h->image_slots.capacity; i++)
+    {
+        void **slot = h->image_slots.slots[i];
+        if (slotset_live(slot))
+        {
+            try_mark(h, &st, *slot);
+        }
+    }
 
-    int done;
-    do
+    ThreadInfo *ti = h->threads;
+    while (ti)
     {
-        done = 1;
-        ThreadInfo *ti = h->threads;
-        while (ti)
+        if (pthread_equal(ti->tid, self))
+        {
+            ti->sp = __builtin_frame_address(0);
+        }
+
+        for (size_t k = 0; k < ti->frame_top; k++)
         {
-            if (!pthread_equal(ti->tid, pthread_self()) &&
-                ti->status != THREAD_PARKED)
+            mark_ref(h, &st, *ti->frame_slots[k], 1);
+        }
+
+        if (ti->sp)
+        {
+            scan_range(h, &st, &ti->regs, (char *)&ti->regs + sizeof(ti->regs));
+            // nit na steku fibera: taj stek pokriva mark_scan_ranges, a okviri njenog
+            // steka ispod prelaza na fiber (thread_enter_fiber) ostaju zivi
+            if (ti->sp >= ti->stack_lo && ti->sp < ti->stack_hi)
             {
-                done = 0;
-                break;
+                scan_range(h, &st, ti->sp, ti->stack_hi);
+            }
+            else if (ti->native_sp)
+            {
+                scan_range(h, &st, &ti->native_regs, (char *)&ti->native_regs + sizeof(ti->native_regs));
+                scan_range(h, &st, ti->native_sp, ti->stack_hi);
             }
-            ti = ti->next;
         }
-        if (!done)
-            pthread_cond_wait(&h->gc_cond, &h->lock);
-    } while (!done);
+        ti = ti->next;
+    }
+
+    mark_scan_ranges(h, &st);
+
+    mark_regions(h, &st);
+    mark_drain(h, &st);
+    mark_ephemerons(h, &st);
+    clear_weak(h);
+    mark_finalizable(h, &st);
 
     markstack_destroy(&st);
 
     size_t freed = 0;
     for_each_block(h, sweep, &freed);
+    sweep_slabs(h);
+    if (h->immix_blocks)
+    {
+        immix_sweep(h);
+        immix_evacuate(h);
+    }
 
-    h->gc_requested = 0;
-    pthread_cond_broadcast(&h->gc_cond);
+    if (h->trace)
+    {
+        trace_collect(h);
+    }
 
-    pthread_mutex_unlock(&h->lock);
-}
\ No newline at end of file
+    if (!heap_single(h))
+    {
+        threads_resume(h);
+    }
+    atomic_store(&h->gc_requested, 0);
+
+    heap_unlock(h);
+}
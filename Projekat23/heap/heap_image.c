@@ -0,0 +1,435 @@
+#include "heap_state.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// slika heap-a: [ImageHeader | koreni | relokacije | ... | podaci od data_off]
+//   koreni: pomeraj od base + 1 (0 = NULL ili pokazivac van heap-a)
+//   relokacije: indeksi reci u podacima koje pokazuju u [base, base + span)
+//   podaci: bajtovi [reserve_lo, reserve_top) heap-a koji je snimljen
+#define IMAGE_MAGIC "HEAPIMG"
+#define IMAGE_VERSION 1
+#define IMAGE_DATA_ALIGN HEAP_CHUNK_BYTES
+
+typedef struct ImageHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t base;
+    uint64_t span;
+    uint64_t n_roots;
+    uint64_t n_relocs;
+    uint64_t data_off;
+} ImageHeader;
+
+typedef struct RelocList
+{
+    uint64_t *v;
+    size_t n;
+    size_t cap;
+    int failed;
+} RelocList;
+
+static size_t round_up(size_t x, size_t a)
+{
+    return (x + (a - 1)) / a * a;
+}
+
+// bez zakljucavanja: reserve_hi je fiksan, a mapa chunkova pokriva celu rezervaciju
+static int in_reserve(const Heap *h, const void *p)
+{
+    const unsigned char *x = (const unsigned char *)p;
+    return x >= h->reserve_lo && x < h->reserve_hi;
+}
+
+static int write_all(int fd, const void *buf, size_t n, off_t off)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    while (n > 0)
+    {
+        ssize_t k = pwrite(fd, p, n, off);
+        if (k < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        p += k;
+        n -= (size_t)k;
+        off += k;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t n, off_t off)
+{
+    unsigned char *p = (unsigned char *)buf;
+    while (n > 0)
+    {
+        ssize_t k = pread(fd, p, n, off);
+        if (k < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (k <= 0)
+        {
+            return -1;
+        }
+        p += k;
+        n -= (size_t)k;
+        off += k;
+    }
+    return 0;
+}
+
+// ------ RELOKACIJE -----------
+static void reloc_word(Heap *h, RelocList *r, void **word)
+{
+    unsigned char *v = (unsigned char *)*word;
+    if (v < h->reserve_lo || v >= h->reserve_top || r->failed)
+    {
+        return;
+    }
+
+    // niti su zaustavljene (mozda usred malloc-a), pa lista raste preko mmap-a
+    if (r->n == r->cap)
+    {
+        size_t cap = r->cap ? r->cap * 2 : 1024;
+        void *nv = mmap(NULL, cap * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (nv == MAP_FAILED)
+        {
+            r->failed = 1;
+            return;
+        }
+        if (r->v)
+        {
+            memcpy(nv, r->v, r->n * sizeof(uint64_t));
+            munmap(r->v, r->cap * sizeof(uint64_t));
+        }
+        r->v = (uint64_t *)nv;
+        r->cap = cap;
+    }
+    r->v[r->n++] = (uint64_t)((unsigned char *)(void *)word - h->reserve_lo) / sizeof(void *);
+}
+
+static void reloc_range(Heap *h, RelocList *r, void *lo, void *hi)
+{
+    for (void **p = (void **)lo; p < (void **)hi; p++)
+    {
+        reloc_word(h, r, p);
+    }
+}
+
+static void reloc_block(Heap *h, RelocList *r, BlockHeader *b)
+{
+    if (b->flags & (BLOCK_FLAG_FREE | BLOCK_FLAG_NOSCAN))
+    {
+        return;
+    }
+
+    unsigned char *payload = (unsigned char *)(void *)(b + 1);
+    if (b->flags & BLOCK_FLAG_TYPED)
+    {
+        const HeapType *type = block_type(b);
+        for (size_t k = 0; k < type->pointer_count; k++)
+        {
+            reloc_word(h, r, (void **)(void *)(payload + type->pointer_offsets[k]));
+        }
+        return;
+    }
+    reloc_range(h, r, payload, payload + b->size);
+}
+
+static void reloc_immix(Heap *h, BlockHeader *b, void *ctx)
+{
+    reloc_block(h, (RelocList *)ctx, b);
+}
+
+// iste reci koje bi GC skenirao; ranije ucitana slika se skenira cela
+static void reloc_collect(Heap *h, RelocList *r)
+{
+    for (Segment *seg = h->segments; seg; seg = seg->next)
+    {
+        unsigned char *cur = seg->mem;
+        unsigned char *end = seg->mem + seg->size;
+        while (cur + sizeof(BlockHeader) <= end)
+        {
+            BlockHeader *b = (BlockHeader *)(void *)cur;
+            if (!block_start_test(h, b))
+            {
+                break;
+            }
+            reloc_block(h, r, b);
+            cur += sizeof(BlockHeader) + b->size;
+        }
+    }
+
+    immix_for_each_object(h, reloc_immix, r);
+
+    for (HeapPool *p = h->pools; p; p = p->next)
+    {
+        for (Slab *s = p->slabs; s; s = s->next)
+        {
+            for (size_t i = 0; i < s->count; i++)
+            {
+                if (s->alloc_bits[i / 64] & ((uint64_t)1 << (i % 64)))
+                {
+                    unsigned char *obj = s->objs + i * s->obj_size;
+                    reloc_range(h, r, obj, obj + s->obj_size);
+                }
+            }
+        }
+    }
+
+    for (HeapRegion *rg = h->regions; rg; rg = rg->next)
+    {
+        for (RegionChunk *c = rg->chunks; c; c = c->next)
+        {
+            unsigned char *cur = (unsigned char *)(void *)c + heap_align_up(sizeof(RegionChunk));
+            while (cur < c->top)
+            {
+                BlockHeader *b = (BlockHeader *)(void *)cur;
+                reloc_block(h, r, b);
+                cur += sizeof(BlockHeader) + b->size;
+            }
+        }
+    }
+
+    // ranije ucitana slika: samo reci koje su pri njenom snimanju bile pokazivaci i
+    // slotovi upisani kroz heap_store; NOSCAN podaci slike se ne diraju
+    for (size_t i = 0; i < h->image_reloc_count; i++)
+    {
+        reloc_word(h, r, (void **)(void *)h->reserve_lo + h->image_relocs[i]);
+    }
+    for (size_t i = 0; i < h->image_slots.capacity; i++)
+    {
+        void **slot = h->image_slots.slots[i];
+        if (slotset_live(slot))
+        {
+            reloc_word(h, r, slot);
+        }
+    }
+}
+
+// ------ SNIMANJE -----------
+int heap_save(Heap *h, const char *path, void *const *roots, size_t n_roots)
+{
+    if (!h || !path || (n_roots > 0 && !roots))
+    {
+        return -1;
+    }
+
+    // u sliku ide samo ono sto je zivo
+    collect_heap(h);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    uint64_t *root_offs = (uint64_t *)calloc(n_roots ? n_roots : 1, sizeof(uint64_t));
+    if (!root_offs)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // kao u collect_now: ostale niti stoje dok se pise, pa podaci i relokacije odgovaraju
+    heap_lock(h);
+    atomic_store(&h->gc_requested, 1);
+    if (!heap_single(h) && threads_suspend(h) != 0)
+    {
+        atomic_store(&h->gc_requested, 0);
+        heap_unlock(h);
+        free(root_offs);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    RelocList r = {0};
+    reloc_collect(h, &r);
+
+    for (size_t i = 0; i < n_roots; i++)
+    {
+        unsigned char *v = (unsigned char *)roots[i];
+        if (v >= h->reserve_lo && v < h->reserve_top)
+        {
+            root_offs[i] = (uint64_t)(v - h->reserve_lo) + 1;
+        }
+    }
+
+    ImageHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    hdr.version = IMAGE_VERSION;
+    hdr.base = (uint64_t)(uintptr_t)h->reserve_lo;
+    hdr.span = (uint64_t)(h->reserve_top - h->reserve_lo);
+    hdr.n_roots = n_roots;
+    hdr.n_relocs = r.n;
+    hdr.data_off = round_up(sizeof(hdr) + (n_roots + r.n) * sizeof(uint64_t), IMAGE_DATA_ALIGN);
+
+    int rc = r.failed ? -1 : 0;
+    if (rc == 0)
+    {
+        off_t off = 0;
+        rc = write_all(fd, &hdr, sizeof(hdr), off);
+        off += (off_t)sizeof(hdr);
+        if (rc == 0)
+        {
+            rc = write_all(fd, root_offs, n_roots * sizeof(uint64_t), off);
+            off += (off_t)(n_roots * sizeof(uint64_t));
+        }
+        if (rc == 0)
+        {
+            rc = write_all(fd, r.v, r.n * sizeof(uint64_t), off);
+        }
+        if (rc == 0)
+        {
+            rc = write_all(fd, h->reserve_lo, (size_t)hdr.span, (off_t)hdr.data_off);
+        }
+    }
+
+    if (!heap_single(h))
+    {
+        threads_resume(h);
+    }
+    atomic_store(&h->gc_requested, 0);
+    heap_unlock(h);
+
+    if (r.v)
+    {
+        munmap(r.v, r.cap * sizeof(uint64_t));
+    }
+    free(root_offs);
+    if (close(fd) != 0)
+    {
+        rc = -1;
+    }
+    if (rc != 0)
+    {
+        unlink(path);
+    }
+    return rc;
+}
+
+// ------ UCITAVANJE -----------
+// slika se mapuje na pocetak rezervacije; ako je stara adresa zauzeta, pokazivaci se pomeraju
+Heap *heap_load(const char *path, const HeapConfig *cfg, void **roots, size_t n_roots)
+{
+    if (!path || !cfg || (n_roots > 0 && !roots))
+    {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    // zaglavlje dolazi iz fajla: zbirovi se proveravaju pre poredjenja da ne bi presli preko
+    const uint64_t max_table = (SIZE_MAX - sizeof(ImageHeader)) / sizeof(uint64_t);
+    ImageHeader hdr;
+    struct stat st;
+    if (read_all(fd, &hdr, sizeof(hdr), 0) != 0 || fstat(fd, &st) != 0 ||
+        memcmp(hdr.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || hdr.version != IMAGE_VERSION ||
+        hdr.span == 0 || hdr.span % HEAP_CHUNK_BYTES != 0 || hdr.data_off % IMAGE_DATA_ALIGN != 0 ||
+        hdr.n_roots > max_table || hdr.n_relocs > max_table - hdr.n_roots ||
+        hdr.data_off < sizeof(hdr) + (hdr.n_roots + hdr.n_relocs) * sizeof(uint64_t) ||
+        hdr.span > UINT64_MAX - hdr.data_off || (uint64_t)st.st_size < hdr.data_off + hdr.span)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    size_t n_table = (size_t)(hdr.n_roots + hdr.n_relocs);
+    uint64_t *table = (uint64_t *)malloc((n_table ? n_table : 1) * sizeof(uint64_t));
+    if (!table || read_all(fd, table, n_table * sizeof(uint64_t), (off_t)sizeof(hdr)) != 0)
+    {
+        free(table);
+        close(fd);
+        return NULL;
+    }
+
+    Heap *h = heap_create_image(cfg, (void *)(uintptr_t)hdr.base, (size_t)hdr.span);
+    if (!h)
+    {
+        free(table);
+        close(fd);
+        return NULL;
+    }
+
+    // MAP_PRIVATE: stranice se citaju iz fajla tek kad zatrebaju
+    unsigned char *lo = h->reserve_lo;
+    if (mmap(lo, (size_t)hdr.span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)hdr.data_off) == MAP_FAILED)
+    {
+        destroy_heap(h);
+        free(table);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    uintptr_t delta = (uintptr_t)lo - (uintptr_t)hdr.base;
+    if (delta != 0)
+    {
+        const uint64_t *relocs = table + hdr.n_roots;
+        size_t words = (size_t)hdr.span / sizeof(void *);
+        for (size_t i = 0; i < (size_t)hdr.n_relocs; i++)
+        {
+            if (relocs[i] < words)
+            {
+                uintptr_t *w = (uintptr_t *)(void *)lo + relocs[i];
+                *w += delta;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n_roots; i++)
+    {
+        uint64_t off = (i < hdr.n_roots) ? table[i] : 0;
+        roots[i] = (off != 0 && off <= hdr.span) ? lo + (off - 1) : NULL;
+    }
+
+    // relokacije ostaju heap-u za sledeci heap_save (samo indeksi unutar slike)
+    size_t words = (size_t)hdr.span / sizeof(void *);
+    size_t k = 0;
+    for (size_t i = 0; i < (size_t)hdr.n_relocs; i++)
+    {
+        if (table[hdr.n_roots + i] < words)
+        {
+            table[k++] = table[hdr.n_roots + i];
+        }
+    }
+    h->image_relocs = table;
+    h->image_reloc_count = k;
+    return h;
+}
+
+// ------ UPIS U SLIKU -----------
+// slika se ne skenira; slot koji iz nje pokazuje na nov objekat GC tretira kao koren,
+// a heap_save ga relocira (i kad pokazuje u samu sliku)
+void image_note_store(Heap *h, void **slot, void *value)
+{
+    if (!value || !in_reserve(h, slot) || heap_chunk_kind(h, slot) != CHUNK_IMAGE)
+    {
+        return;
+    }
+    if (!in_reserve(h, value))
+    {
+        return;
+    }
+
+    heap_lock(h);
+    slotset_add(&h->image_slots, slot);
+    heap_unlock(h);
+}
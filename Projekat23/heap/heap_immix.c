@@ -0,0 +1,534 @@
+#include "heap_state.h"
+#include <string.h>
+
+// Immix: bump alokacija u rupe od slobodnih linija, mark oznacava zive linije,
+// sweep samo prebrojava linije; retki blokovi se u ciklusu prazne premestanjem
+
+static unsigned char *line_addr(ImmixBlock *blk, size_t i)
+{
+    return (unsigned char *)(void *)blk + i * IMMIX_LINE_BYTES;
+}
+
+// cursor/limit su NULL dok nema rupe
+static size_t room(const unsigned char *cursor, const unsigned char *limit)
+{
+    return (size_t)((uintptr_t)limit - (uintptr_t)cursor);
+}
+
+static size_t count_free_lines(const ImmixBlock *blk)
+{
+    size_t n = 0;
+    for (size_t i = IMMIX_FIRST_LINE; i < IMMIX_LINES; i++)
+    {
+        n += !blk->line_mark[i];
+    }
+    return n;
+}
+
+// ------ BLOKOVI -----------
+static ImmixBlock *immix_block_new(Heap *h)
+{
+    unsigned char *base = chunk_take(h, CHUNK_IMMIX);
+    if (!base)
+    {
+        return NULL;
+    }
+
+    // chunk je mozda ranije bio region; stari bitovi pocetaka ne vaze
+    size_t w = heap_word_index(h, base);
+    memset(&h->block_starts[w / 64], 0, HEAP_CHUNK_BYTES / HEAP_ALIGNMENT / 8);
+
+    ImmixBlock *blk = (ImmixBlock *)(void *)base;
+    memset(blk, 0, sizeof(ImmixBlock));
+    blk->free_lines = IMMIX_USABLE_LINES;
+    blk->next = h->immix_blocks;
+    h->immix_blocks = blk;
+    return blk;
+}
+
+// fn sme da obrise bit objekta koji upravo obilazi
+static void block_objects(Heap *h, ImmixBlock *blk, void (*fn)(Heap *h, BlockHeader *b, void *ctx), void *ctx)
+{
+    size_t w0 = heap_word_index(h, blk) / 64;
+    for (size_t k = 0; k < HEAP_CHUNK_BYTES / HEAP_ALIGNMENT / 64; k++)
+    {
+        uint64_t bits = h->block_starts[w0 + k];
+        while (bits)
+        {
+            size_t bit = (size_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            fn(h, (BlockHeader *)(void *)((unsigned char *)(void *)blk + (k * 64 + bit) * HEAP_ALIGNMENT), ctx);
+        }
+    }
+}
+
+void immix_for_each_object(Heap *h, void (*fn)(Heap *h, BlockHeader *b, void *ctx), void *ctx)
+{
+    for (ImmixBlock *blk = h->immix_blocks; blk; blk = blk->next)
+    {
+        block_objects(h, blk, fn, ctx);
+    }
+}
+
+// ------ ALOKACIJA -----------
+// sledeca rupa u tekucem bloku ili u sledecem bloku sa slobodnim linijama
+// grow == 0: samo blokovi koji vec postoje (try_alloc_heap)
+static int immix_next_hole(Heap *h, int grow)
+{
+    for (;;)
+    {
+        ImmixBlock *blk = h->immix_cur;
+        if (blk)
+        {
+            size_t i = h->immix_line;
+            while (i < IMMIX_LINES && blk->line_mark[i])
+            {
+                i++;
+            }
+            size_t j = i;
+            while (j < IMMIX_LINES && !blk->line_mark[j])
+            {
+                j++;
+            }
+            h->immix_line = j;
+            if (i < j)
+            {
+                h->immix_cursor = line_addr(blk, i);
+                h->immix_limit = line_addr(blk, j);
+                memset(h->immix_cursor, 0, room(h->immix_cursor, h->immix_limit));
+                return 0;
+            }
+        }
+
+        blk = h->immix_avail;
+        if (blk)
+        {
+            h->immix_avail = blk->next_avail;
+        }
+        else
+        {
+            blk = grow ? immix_block_new(h) : NULL;
+            if (!blk)
+            {
+                return -1;
+            }
+        }
+        h->immix_cur = blk;
+        h->immix_line = IMMIX_FIRST_LINE;
+    }
+}
+
+// srednji objekat koji ne staje u tekucu rupu ide u prazan blok, da rupe ne propadaju
+static int immix_next_overflow(Heap *h, int grow)
+{
+    ImmixBlock **pp = &h->immix_avail;
+    while (*pp && (*pp)->free_lines != IMMIX_USABLE_LINES)
+    {
+        pp = &(*pp)->next_avail;
+    }
+
+    ImmixBlock *blk = *pp;
+    if (blk)
+    {
+        *pp = blk->next_avail;
+    }
+    else
+    {
+        blk = grow ? immix_block_new(h) : NULL;
+        if (!blk)
+        {
+            return -1;
+        }
+    }
+
+    h->immix_ovf_cursor = line_addr(blk, IMMIX_FIRST_LINE);
+    h->immix_ovf_limit = line_addr(blk, IMMIX_LINES);
+    memset(h->immix_ovf_cursor, 0, room(h->immix_ovf_cursor, h->immix_ovf_limit));
+    return 0;
+}
+
+// req je poravnat, sizeof(BlockHeader) + req <= IMMIX_MAX_OBJECT; payload je nuliran
+BlockHeader *immix_alloc(Heap *h, size_t req, uint32_t flags, int grow)
+{
+    size_t need = sizeof(BlockHeader) + req;
+    unsigned char **cursor = &h->immix_cursor;
+
+    if (need > room(h->immix_cursor, h->immix_limit))
+    {
+        if (need > IMMIX_LINE_BYTES)
+        {
+            cursor = &h->immix_ovf_cursor;
+            if (need > room(h->immix_ovf_cursor, h->immix_ovf_limit) && immix_next_overflow(h, grow) != 0)
+            {
+                return NULL;
+            }
+        }
+        else if (immix_next_hole(h, grow) != 0)
+        {
+            return NULL;
+        }
+    }
+
+    BlockHeader *b = (BlockHeader *)(void *)*cursor;
+    *cursor += need;
+    b->size = req;
+    b->flags = flags;
+    block_start_set(h, b);
+    h->allocated_bytes += req;
+    return b;
+}
+
+// sakupljac posle promasaja try_alloc_heap: bar jedan blok spreman u listi
+int immix_refill(Heap *h, size_t req)
+{
+    size_t need = sizeof(BlockHeader) + req;
+    if (need <= room(h->immix_cursor, h->immix_limit) || h->immix_avail)
+    {
+        return 0;
+    }
+
+    ImmixBlock *blk = immix_block_new(h);
+    if (!blk)
+    {
+        return -1;
+    }
+    blk->next_avail = h->immix_avail;
+    h->immix_avail = blk;
+    return 0;
+}
+
+// heap_trim: prazni blokovi iz liste slobodnih (od sweep-a netaknuti) vracaju se OS-u
+size_t immix_trim(Heap *h)
+{
+    size_t n = 0;
+    for (ImmixBlock **pp = &h->immix_avail; *pp;)
+    {
+        ImmixBlock *blk = *pp;
+        if (blk->free_lines == IMMIX_USABLE_LINES)
+        {
+            *pp = blk->next_avail;
+            blk->released = 1;
+            n++;
+        }
+        else
+        {
+            pp = &blk->next_avail;
+        }
+    }
+
+    for (ImmixBlock **pp = &h->immix_blocks; n > 0 && *pp;)
+    {
+        ImmixBlock *blk = *pp;
+        if (blk->released)
+        {
+            *pp = blk->next;
+            chunk_release(h, blk);
+        }
+        else
+        {
+            pp = &blk->next;
+        }
+    }
+    return n;
+}
+
+// objekat nestaje iz bitmape; njegove linije se vracaju posle sledeceg mark-a
+void immix_free_locked(Heap *h, BlockHeader *b)
+{
+    block_start_clear(h, b);
+    h->allocated_bytes = (h->allocated_bytes >= b->size) ? h->allocated_bytes - b->size : 0;
+}
+
+// ------ POCETAK CIKLUSA -----------
+// kandidati su najretki blokovi (po broju linija iz proslog sweep-a), dok god njihove
+// zive linije staju u slobodne linije ostalih blokova
+void immix_prepare(Heap *h)
+{
+    size_t count[IMMIX_USABLE_LINES + 1];
+    memset(count, 0, sizeof(count));
+    size_t free_total = 0;
+
+    for (ImmixBlock *blk = h->immix_blocks; blk; blk = blk->next)
+    {
+        memset(blk->line_mark, 0, sizeof(blk->line_mark));
+        blk->evacuate = 0;
+        count[IMMIX_USABLE_LINES - blk->free_lines]++;
+        free_total += blk->free_lines;
+    }
+
+    size_t required = 0;
+    size_t threshold = 0;
+    for (size_t live = 1; live <= IMMIX_USABLE_LINES / 2; live++)
+    {
+        size_t lines = count[live] * live;
+        free_total -= count[live] * (IMMIX_USABLE_LINES - live);
+        if (required + lines > free_total)
+        {
+            break;
+        }
+        required += lines;
+        threshold = live;
+    }
+
+    for (ImmixBlock *blk = h->immix_blocks; threshold > 0 && blk; blk = blk->next)
+    {
+        size_t live = IMMIX_USABLE_LINES - blk->free_lines;
+        blk->evacuate = live >= 1 && live <= threshold;
+    }
+}
+
+// ------ SWEEP -----------
+static void sweep_object(Heap *h, BlockHeader *b, void *ctx)
+{
+    (void)ctx;
+    if (b->flags & BLOCK_FLAG_MARK)
+    {
+        b->flags &= ~BLOCK_FLAG_MARK;
+        return;
+    }
+
+    if (h->trace)
+    {
+        trace_gc_free(h, b + 1);
+    }
+    immix_free_locked(h, b);
+}
+
+// delimicno puni blokovi idu ispred praznih; kandidati cekaju kraj praznjenja
+void immix_sweep(Heap *h)
+{
+    ImmixBlock *partial = NULL;
+    ImmixBlock *partial_tail = NULL;
+    ImmixBlock *empty = NULL;
+
+    for (ImmixBlock *blk = h->immix_blocks; blk; blk = blk->next)
+    {
+        block_objects(h, blk, sweep_object, NULL);
+        blk->free_lines = count_free_lines(blk);
+        if (blk->evacuate || blk->free_lines == 0)
+        {
+            continue;
+        }
+
+        if (blk->free_lines == IMMIX_USABLE_LINES)
+        {
+            blk->next_avail = empty;
+            empty = blk;
+        }
+        else
+        {
+            blk->next_avail = partial;
+            partial = blk;
+            if (!partial_tail)
+            {
+                partial_tail = blk;
+            }
+        }
+    }
+
+    if (partial_tail)
+    {
+        partial_tail->next_avail = empty;
+        h->immix_avail = partial;
+    }
+    else
+    {
+        h->immix_avail = empty;
+    }
+
+    h->immix_cur = NULL;
+    h->immix_line = 0;
+    h->immix_cursor = h->immix_limit = NULL;
+    h->immix_ovf_cursor = h->immix_ovf_limit = NULL;
+}
+
+// ------ PRAZNJENJE -----------
+// zaglavlje Immix objekta na p; p iz korena, slabih slotova i polja moze biti NULL
+// ili bilo koja vrednost, pa se zaglavlje racuna tek kad je p u rezervaciji
+static BlockHeader *immix_header(Heap *h, void *p)
+{
+    if (!p || !heap_contains(h, p) || heap_chunk_kind(h, p) != CHUNK_IMMIX)
+    {
+        return NULL;
+    }
+    BlockHeader *b = (BlockHeader *)p - 1;
+    if (!heap_contains(h, b) || heap_chunk_kind(h, b) != CHUNK_IMMIX || !block_start_test(h, b))
+    {
+        return NULL;
+    }
+    return b;
+}
+
+static void pin(Heap *h, void *p)
+{
+    BlockHeader *b = immix_header(h, p);
+    if (b)
+    {
+        b->flags |= BLOCK_FLAG_PINNED;
+    }
+}
+
+static void *forward(Heap *h, void *p)
+{
+    BlockHeader *b = immix_header(h, p);
+    if (b && (b->flags & BLOCK_FLAG_FORWARDED))
+    {
+        return *(void **)p;
+    }
+    return p;
+}
+
+typedef struct EvacState
+{
+    size_t moved;
+    int out_of_space;
+} EvacState;
+
+static void evacuate_object(Heap *h, BlockHeader *b, void *ctx)
+{
+    EvacState *es = (EvacState *)ctx;
+    if ((b->flags & BLOCK_FLAG_PINNED) || es->out_of_space)
+    {
+        return;
+    }
+
+    // kandidati nisu u listi slobodnih, pa kopija uvek ide u drugi blok
+    BlockHeader *nb = immix_alloc(h, b->size, b->flags, 1);
+    if (!nb)
+    {
+        es->out_of_space = 1;
+        return;
+    }
+    h->allocated_bytes -= b->size;
+    memcpy(nb + 1, b + 1, b->size);
+
+    b->flags |= BLOCK_FLAG_FORWARDED;
+    *(void **)(void *)(b + 1) = nb + 1;
+    if (h->trace)
+    {
+        trace_move(h, b + 1, nb + 1);
+    }
+    es->moved++;
+}
+
+static void forward_typed(Heap *h, BlockHeader *b, void *ctx)
+{
+    (void)ctx;
+    if ((b->flags & (BLOCK_FLAG_TYPED | BLOCK_FLAG_FREE | BLOCK_FLAG_FORWARDED)) != BLOCK_FLAG_TYPED)
+    {
+        return;
+    }
+
+    unsigned char *payload = (unsigned char *)(void *)(b + 1);
+    const HeapType *type = block_type(b);
+    for (size_t k = 0; k < type->pointer_count; k++)
+    {
+        void **field = (void **)(void *)(payload + type->pointer_offsets[k]);
+        *field = forward(h, *field);
+    }
+}
+
+static void forward_slots(Heap *h, SlotSet *s)
+{
+    for (size_t i = 0; i < s->capacity; i++)
+    {
+        void **slot = s->slots[i];
+        if (slotset_live(slot))
+        {
+            *slot = forward(h, *slot);
+        }
+    }
+}
+
+// precizne reference: koreni, okviri korena, slabe reference i polja tipiziranih objekata
+static void forward_all(Heap *h)
+{
+    forward_slots(h, &h->roots);
+    forward_slots(h, &h->weak);
+
+    for (ThreadInfo *ti = h->threads; ti; ti = ti->next)
+    {
+        for (size_t k = 0; k < ti->frame_top; k++)
+        {
+            *ti->frame_slots[k] = forward(h, *ti->frame_slots[k]);
+        }
+    }
+
+    for (Segment *seg = h->segments; seg; seg = seg->next)
+    {
+        unsigned char *cur = seg->mem;
+        unsigned char *end = seg->mem + seg->size;
+        while (cur + sizeof(BlockHeader) <= end)
+        {
+            BlockHeader *b = (BlockHeader *)(void *)cur;
+            if (!block_start_test(h, b))
+            {
+                break;
+            }
+            forward_typed(h, b, NULL);
+            cur += sizeof(BlockHeader) + b->size;
+        }
+    }
+    immix_for_each_object(h, forward_typed, NULL);
+}
+
+static void release_forwarded(Heap *h, BlockHeader *b, void *ctx)
+{
+    (void)ctx;
+    if (b->flags & BLOCK_FLAG_FORWARDED)
+    {
+        block_start_clear(h, b);
+        return;
+    }
+    b->flags &= ~BLOCK_FLAG_PINNED;
+    immix_mark_lines(immix_block_of(h, b), b);
+}
+
+// posle sweep-a: bitovi pocetaka u kandidatima su tacno zivi objekti
+void immix_evacuate(Heap *h)
+{
+    // tabele efemerona su hesirane po adresi kljuca; njihovi objekti ostaju na mestu
+    for (EphemeronTable *t = h->ephemerons; t; t = t->next)
+    {
+        for (size_t i = 0; i < t->capacity; i++)
+        {
+            EphemeronEntry *e = &t->entries[i];
+            if (ephemeron_entry_live(e))
+            {
+                pin(h, e->key);
+                pin(h, e->value);
+            }
+        }
+    }
+
+    EvacState es = {0, 0};
+    for (ImmixBlock *blk = h->immix_blocks; blk; blk = blk->next)
+    {
+        if (blk->evacuate)
+        {
+            block_objects(h, blk, evacuate_object, &es);
+        }
+    }
+
+    if (es.moved > 0)
+    {
+        forward_all(h);
+    }
+
+    for (ImmixBlock *blk = h->immix_blocks; blk; blk = blk->next)
+    {
+        if (!blk->evacuate)
+        {
+            continue;
+        }
+        memset(blk->line_mark, 0, sizeof(blk->line_mark));
+        block_objects(h, blk, release_forwarded, NULL);
+        blk->evacuate = 0;
+        blk->free_lines = count_free_lines(blk);
+        if (blk->free_lines > 0)
+        {
+            blk->next_avail = h->immix_avail;
+            h->immix_avail = blk;
+        }
+    }
+}
@@ -4,6 +4,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#if defined(__clang__) || defined(__GNUC__)
+#define HEAP_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define HEAP_NO_SANITIZE_ADDRESS
+#endif
+
 #define HEAP_ALIGNMENT ((size_t)sizeof(void *))
 
 static inline size_t heap_align_up(size_t x)
@@ -12,20 +18,58 @@ static inline size_t heap_align_up(size_t x)
     return (x + (a - 1)) & ~(a - 1);
 }
 
-#define BLOCK_MAGIC 0xC0FFEE01u
+static inline size_t heap_ptr_hash(const void *p)
+{
+    uint64_t x = (uint64_t)(uintptr_t)p >> 3;
+    x *= 0x9E3779B97F4A7C15ull;
+    return (size_t)(x >> 17);
+}
 
 #define BLOCK_FLAG_FREE (1u << 0)
 #define BLOCK_FLAG_MARK (1u << 1)
+#define BLOCK_FLAG_ZEROED (1u << 2)
+#define BLOCK_FLAG_NOSCAN (1u << 3)
+#define BLOCK_FLAG_TYPED (1u << 4)
+#define BLOCK_FLAG_PINNED (1u << 5)    // Immix: dohvacen dvosmislenom referencom
+#define BLOCK_FLAG_FORWARDED (1u << 6) // Immix: premesten, nova adresa u prvoj reci payload-a
+#define BLOCK_FLAG_FINAL (1u << 7)     // u registru finalizatora heap-a
+#define BLOCK_FLAG_RELEASED (1u << 8)  // slobodan blok cije je stranice heap_trim vratio OS-u
+#define BLOCK_FLAG_REGION (1u << 9)    // veliki objekat otvorenog regiona (blok segmenta)
+
+typedef struct HeapType HeapType;
 
+// jedna rec: zastavice + velicina payload-a (uvek umnozak HEAP_ALIGNMENT)
+// slobodan blok cuva next u prvoj reci payload-a, tipiziran blok svoj HeapType u poslednjoj;
+// da li je adresa pocetak bloka zna bitmapa pocetaka heap-a, ne zaglavlje
 typedef struct BlockHeader BlockHeader;
 struct BlockHeader
 {
-    size_t size;
-    BlockHeader *next_free;
-    uint32_t magic;
-    uint32_t flags;
+    size_t flags : 10;
+    size_t size : 54;
 };
 
+_Static_assert(sizeof(BlockHeader) == sizeof(size_t), "BlockHeader must be one word");
+
+static inline BlockHeader *block_next_free(const BlockHeader *b)
+{
+    return *(BlockHeader *const *)(const void *)(b + 1);
+}
+
+static inline void block_set_next_free(BlockHeader *b, BlockHeader *next)
+{
+    *(BlockHeader **)(void *)(b + 1) = next;
+}
+
+static inline const HeapType **block_type_slot(BlockHeader *b)
+{
+    return (const HeapType **)(void *)((unsigned char *)(void *)(b + 1) + b->size - sizeof(void *));
+}
+
+static inline const HeapType *block_type(BlockHeader *b)
+{
+    return *block_type_slot(b);
+}
+
 typedef struct Segment Segment;
 struct Segment
 {
@@ -0,0 +1,237 @@
+#include "heap_state.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// ------ SLAB -----------
+static void slab_init(Slab *s, HeapPool *p)
+{
+    size_t hdr = heap_align_up(sizeof(Slab));
+    size_t n = (HEAP_SLAB_BYTES - hdr) / p->obj_size;
+    size_t words;
+    size_t objs_off;
+
+    // objekti pocinju na granici kes linije, iza obe bitmape
+    for (;;)
+    {
+        words = (n + 63) / 64;
+        objs_off = (hdr + 2 * words * sizeof(uint64_t) + 63) & ~(size_t)63;
+        if (objs_off + n * p->obj_size <= HEAP_SLAB_BYTES)
+        {
+            break;
+        }
+        n--;
+    }
+
+    unsigned char *base = (unsigned char *)(void *)s;
+    s->pool = p;
+    s->next = NULL;
+    s->next_partial = NULL;
+    s->in_partial = 0;
+    s->objs = base + objs_off;
+    s->obj_size = p->obj_size;
+    s->count = n;
+    s->free_count = n;
+    s->hint = 0;
+    s->alloc_bits = (uint64_t *)(void *)(base + hdr);
+    s->mark_bits = s->alloc_bits + words;
+    s->words = words;
+    memset(s->alloc_bits, 0, 2 * words * sizeof(uint64_t));
+}
+
+static void slab_make_available(HeapPool *p, Slab *s)
+{
+    if (!s->in_partial && s->free_count > 0)
+    {
+        s->next_partial = p->partial;
+        p->partial = s;
+        s->in_partial = 1;
+    }
+}
+
+static Slab *slab_new(Heap *h, HeapPool *p)
+{
+    Slab *s = (Slab *)(void *)chunk_take(h, CHUNK_SLAB);
+    if (!s)
+    {
+        return NULL;
+    }
+
+    slab_init(s, p);
+    s->next = p->slabs;
+    p->slabs = s;
+    slab_make_available(p, s);
+    return s;
+}
+
+static void slab_release(Heap *h, Slab *s)
+{
+    size_t live = s->count - s->free_count;
+    size_t bytes = live * s->obj_size;
+    h->allocated_bytes = (h->allocated_bytes >= bytes) ? h->allocated_bytes - bytes : 0;
+
+    // objekti vise ne trebaju; stranice se vracaju OS-u, prva ostaje za vezu u listi
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (page < HEAP_SLAB_BYTES)
+    {
+        madvise((unsigned char *)(void *)s + page, HEAP_SLAB_BYTES - page, MADV_DONTNEED);
+    }
+    chunk_give(h, s);
+}
+
+// ------ POOL -----------
+HeapPool *heap_pool_create(Heap *h, size_t obj_size)
+{
+    if (!h || obj_size == 0 || obj_size > HEAP_POOL_MAX_OBJ)
+    {
+        return NULL;
+    }
+
+    HeapPool *p = (HeapPool *)calloc(1, sizeof(HeapPool));
+    if (!p)
+    {
+        return NULL;
+    }
+    p->heap = h;
+    p->obj_size = heap_align_up(obj_size);
+
+    heap_lock(h);
+    p->next = h->pools;
+    h->pools = p;
+    heap_unlock(h);
+
+    return p;
+}
+
+void heap_pool_destroy(HeapPool *p)
+{
+    if (!p)
+    {
+        return;
+    }
+
+    Heap *h = p->heap;
+    heap_lock(h);
+
+    HeapPool **pp = &h->pools;
+    while (*pp)
+    {
+        if (*pp == p)
+        {
+            *pp = p->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+
+    while (p->slabs)
+    {
+        Slab *s = p->slabs;
+        p->slabs = s->next;
+        slab_release(h, s);
+    }
+
+    heap_unlock(h);
+    free(p);
+}
+
+// zove destroy_heap; memorija slabova nestaje sa rezervacijom
+void pool_destroy_all(Heap *h)
+{
+    while (h->pools)
+    {
+        HeapPool *p = h->pools;
+        h->pools = p->next;
+        free(p);
+    }
+}
+
+void *heap_pool_alloc(HeapPool *p)
+{
+    if (!p)
+    {
+        return NULL;
+    }
+
+    Heap *h = p->heap;
+    gc_safepoint(h);
+    heap_lock(h);
+
+    while (p->partial && p->partial->free_count == 0)
+    {
+        Slab *full = p->partial;
+        p->partial = full->next_partial;
+        full->in_partial = 0;
+    }
+
+    Slab *s = p->partial;
+    if (!s)
+    {
+        s = slab_new(h, p);
+        if (!s)
+        {
+            heap_unlock(h);
+            return NULL;
+        }
+    }
+
+    size_t w = s->hint;
+    uint64_t free_bits;
+    for (;;)
+    {
+        free_bits = ~s->alloc_bits[w];
+        if (w == s->words - 1 && (s->count % 64) != 0)
+        {
+            free_bits &= ((uint64_t)1 << (s->count % 64)) - 1;
+        }
+        if (free_bits)
+        {
+            break;
+        }
+        w = (w + 1 == s->words) ? 0 : w + 1;
+    }
+
+    unsigned bit = (unsigned)__builtin_ctzll(free_bits);
+    s->alloc_bits[w] |= (uint64_t)1 << bit;
+    s->free_count--;
+    s->hint = w;
+    h->allocated_bytes += s->obj_size;
+
+    void *obj = s->objs + (w * 64 + bit) * s->obj_size;
+    memset(obj, 0, s->obj_size);
+
+    heap_unlock(h);
+    return obj;
+}
+
+void pool_free_locked(Heap *h, void *obj)
+{
+    Slab *s = heap_slab_of(h, obj);
+    size_t i = s ? slab_index(s, obj) : (size_t)-1;
+    if (i == (size_t)-1)
+    {
+        return;
+    }
+
+    s->alloc_bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+    s->free_count++;
+    h->allocated_bytes = (h->allocated_bytes >= s->obj_size) ? h->allocated_bytes - s->obj_size : 0;
+    slab_make_available(s->pool, s);
+}
+
+void heap_pool_free(HeapPool *p, void *obj)
+{
+    if (!p || !obj)
+    {
+        return;
+    }
+
+    Heap *h = p->heap;
+    heap_lock(h);
+    if (heap_contains(h, obj))
+    {
+        pool_free_locked(h, obj);
+    }
+    heap_unlock(h);
+}
@@ -0,0 +1,396 @@
+#include "heap_state.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void free_list_push(BlockHeader **head, BlockHeader *block)
+{
+    block_set_next_free(block, *head);
+    *head = block;
+}
+
+static unsigned char *chunk_objects(RegionChunk *c)
+{
+    return (unsigned char *)(void *)c + heap_align_up(sizeof(RegionChunk));
+}
+
+static unsigned char *chunk_end(RegionChunk *c)
+{
+    return (unsigned char *)(void *)c - sizeof(BlockHeader) + HEAP_CHUNK_BYTES;
+}
+
+// bez zakljucavanja: reserve_hi je fiksan, a mapa chunkova pokriva celu rezervaciju
+static int in_reserve(const Heap *h, const void *p)
+{
+    const unsigned char *x = (const unsigned char *)p;
+    return x >= h->reserve_lo && x < h->reserve_hi;
+}
+
+// ------ CHUNK REGIONA -----------
+static RegionChunk *region_chunk_new(HeapRegion *r)
+{
+    Heap *h = r->heap;
+
+    // Segment se pravi unapred da unapredjenje na kraju regiona ne moze da padne
+    Segment *seg = (Segment *)malloc(sizeof(Segment));
+    if (!seg)
+    {
+        return NULL;
+    }
+
+    heap_lock(h);
+    unsigned char *base = chunk_take(h, CHUNK_REGION);
+    if (!base)
+    {
+        heap_unlock(h);
+        free(seg);
+        return NULL;
+    }
+
+    BlockHeader *hdr = (BlockHeader *)(void *)base;
+    hdr->size = heap_align_up(sizeof(RegionChunk));
+    hdr->flags = BLOCK_FLAG_NOSCAN;
+
+    RegionChunk *c = (RegionChunk *)(void *)(hdr + 1);
+    c->region = r;
+    c->top = chunk_objects(c);
+    c->seg = seg;
+    seg->mem = base;
+    seg->size = HEAP_CHUNK_BYTES;
+    seg->next = NULL;
+
+    c->next = r->chunks;
+    r->chunks = c;
+    heap_unlock(h);
+
+    return c;
+}
+
+// chunk pobeglog regiona postaje obican segment; zivost objekata odredjuje sledeci GC
+static void region_chunk_promote(Heap *h, RegionChunk *c)
+{
+    unsigned char *base = (unsigned char *)(void *)c - sizeof(BlockHeader);
+    unsigned char *end = chunk_end(c);
+    unsigned char *top = c->top;
+    Segment *seg = c->seg;
+
+    // bitmapa pocetaka vazi samo za segmente; chunk je mozda ranije bio nesto drugo
+    size_t w = heap_word_index(h, base);
+    memset(&h->block_starts[w / 64], 0, HEAP_CHUNK_BYTES / HEAP_ALIGNMENT / 8);
+    block_start_set(h, (BlockHeader *)(void *)base);
+
+    for (unsigned char *cur = chunk_objects(c); cur < top;)
+    {
+        BlockHeader *b = (BlockHeader *)(void *)cur;
+        block_start_set(h, b);
+        h->allocated_bytes += b->size;
+        cur += sizeof(BlockHeader) + b->size;
+    }
+
+    if ((size_t)(end - top) >= sizeof(BlockHeader) + HEAP_ALIGNMENT)
+    {
+        BlockHeader *tail = (BlockHeader *)(void *)top;
+        tail->size = (size_t)(end - top) - sizeof(BlockHeader);
+        tail->flags = BLOCK_FLAG_FREE;
+        block_start_set(h, tail);
+        free_list_push(free_list_of(h, tail->size), tail);
+    }
+
+    // zaglavlje chunka postaje obican blok; sweep ga oslobadja kao i ostale
+    h->allocated_bytes += ((BlockHeader *)(void *)base)->size;
+    h->chunk_map[(size_t)(base - h->reserve_lo) / HEAP_CHUNK_BYTES] = CHUNK_SEGMENT;
+    seg->next = h->segments;
+    h->segments = seg;
+}
+
+// ------ VELIKI OBJEKTI -----------
+// objekat veci od chunka je blok segmenta (BLOCK_FLAG_REGION); mark_regions ga markira
+// dok je region otvoren, a heap_region_end ga oslobadja ako region nije pobegao
+static void *region_alloc_large(HeapRegion *r, size_t size_bytes)
+{
+    Heap *h = r->heap;
+
+    // mesto u listi pre alokacije, pa upis posle ne moze da padne
+    heap_lock(h);
+    if (r->large_count == r->large_cap)
+    {
+        size_t new_cap = (r->large_cap == 0) ? 8 : r->large_cap * 2;
+        void **nl = (void **)realloc(r->large, new_cap * sizeof(void *));
+        if (!nl)
+        {
+            heap_unlock(h);
+            return NULL;
+        }
+        r->large = nl;
+        r->large_cap = new_cap;
+    }
+    heap_unlock(h);
+
+    void *obj = alloc_heap(h, size_bytes);
+    if (!obj)
+    {
+        return NULL;
+    }
+
+    heap_lock(h);
+    ((BlockHeader *)obj - 1)->flags |= BLOCK_FLAG_REGION;
+    r->large[r->large_count++] = obj;
+    atomic_fetch_add(&h->region_large, 1);
+    heap_unlock(h);
+
+    return obj;
+}
+
+static int region_large_index(const HeapRegion *r, const void *obj, size_t *index)
+{
+    for (size_t i = 0; i < r->large_count; i++)
+    {
+        if (r->large[i] == obj)
+        {
+            *index = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// free_heap nad velikim objektom otvorenog regiona (pod lock-om)
+void region_forget_large(Heap *h, void *obj)
+{
+    for (HeapRegion *r = h->regions; r; r = r->next)
+    {
+        size_t i;
+        if (region_large_index(r, obj, &i))
+        {
+            r->large[i] = r->large[--r->large_count];
+            atomic_fetch_sub(&h->region_large, 1);
+            break;
+        }
+    }
+    ((BlockHeader *)obj - 1)->flags &= ~BLOCK_FLAG_REGION;
+}
+
+// slot pripada regionu: u njegovom chunku ili u nekom od njegovih velikih objekata
+static int region_owns_slot(const Heap *h, const HeapRegion *r, void **slot)
+{
+    if (in_reserve(h, slot) && heap_chunk_kind(h, slot) == CHUNK_REGION)
+    {
+        return heap_region_chunk_of(h, slot)->region == r;
+    }
+    for (size_t i = 0; i < r->large_count; i++)
+    {
+        unsigned char *lo = (unsigned char *)r->large[i];
+        if ((unsigned char *)slot >= lo && (unsigned char *)slot < lo + ((BlockHeader *)(void *)lo - 1)->size)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// value je mozda veliki objekat regiona; retko, pa pod lock-om
+static void region_note_store_large(Heap *h, void **slot, void *value)
+{
+    heap_lock(h);
+    BlockHeader *b = (BlockHeader *)value - 1;
+    if (heap_contains(h, b) && block_start_test(h, b) && (b->flags & BLOCK_FLAG_REGION))
+    {
+        for (HeapRegion *r = h->regions; r; r = r->next)
+        {
+            size_t i;
+            if (region_large_index(r, value, &i))
+            {
+                if (!region_owns_slot(h, r, slot))
+                {
+                    atomic_store(&r->escaped, 1);
+                }
+                break;
+            }
+        }
+    }
+    heap_unlock(h);
+}
+
+// ------ REGIONI -----------
+HeapRegion *heap_region_begin(Heap *h)
+{
+    if (!h)
+    {
+        return NULL;
+    }
+
+    HeapRegion *r = (HeapRegion *)calloc(1, sizeof(HeapRegion));
+    if (!r)
+    {
+        return NULL;
+    }
+    r->heap = h;
+    atomic_init(&r->escaped, 0);
+
+    heap_lock(h);
+    r->next = h->regions;
+    h->regions = r;
+    heap_unlock(h);
+
+    return r;
+}
+
+void *heap_region_alloc(HeapRegion *r, size_t size_bytes)
+{
+    if (!r || size_bytes == 0)
+    {
+        return NULL;
+    }
+
+    size_t req = heap_align_up(size_bytes);
+    size_t need = sizeof(BlockHeader) + req;
+
+    // veliki objekat ne staje u chunk; ide u obican heap, a region ga drzi zivim
+    if (need > HEAP_CHUNK_BYTES - sizeof(BlockHeader) - heap_align_up(sizeof(RegionChunk)))
+    {
+        return region_alloc_large(r, size_bytes);
+    }
+
+    RegionChunk *c = r->chunks;
+    if (!c || (size_t)(chunk_end(c) - c->top) < need)
+    {
+        c = region_chunk_new(r);
+        if (!c)
+        {
+            return NULL;
+        }
+    }
+
+    BlockHeader *b = (BlockHeader *)(void *)c->top;
+    b->size = req;
+    b->flags = 0;
+    memset(b + 1, 0, req);
+
+    // sakupljac cita top tek kad je nit zaustavljena; blok mora biti upisan pre njega
+    atomic_signal_fence(memory_order_seq_cst);
+    c->top += need;
+
+    return b + 1;
+}
+
+void heap_region_end(HeapRegion *r)
+{
+    if (!r)
+    {
+        return;
+    }
+
+    Heap *h = r->heap;
+    int escaped = atomic_load(&r->escaped);
+
+    heap_lock(h);
+
+    HeapRegion **pp = &h->regions;
+    while (*pp)
+    {
+        if (*pp == r)
+        {
+            *pp = r->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+
+    while (r->chunks)
+    {
+        RegionChunk *c = r->chunks;
+        r->chunks = c->next;
+        c->region = NULL;
+
+        if (escaped)
+        {
+            region_chunk_promote(h, c);
+        }
+        else
+        {
+            free(c->seg);
+            chunk_give(h, (unsigned char *)(void *)c - sizeof(BlockHeader));
+        }
+    }
+
+    // pobegli region ostavlja velike objekte sledecem GC-u, inace umiru sa regionom
+    for (size_t i = 0; i < r->large_count; i++)
+    {
+        ((BlockHeader *)r->large[i] - 1)->flags &= ~BLOCK_FLAG_REGION;
+        if (!escaped)
+        {
+            free_locked(h, r->large[i]);
+        }
+    }
+    atomic_fetch_sub(&h->region_large, (int)r->large_count);
+
+    heap_unlock(h);
+    free(r->large);
+    free(r);
+}
+
+// ------ BEG IZ REGIONA -----------
+
+// value je objekat regiona; slot van tog regiona znaci da objekat moze nadziveti region
+void region_note_store(Heap *h, void **slot, void *value)
+{
+    if (!value || !in_reserve(h, value))
+    {
+        return;
+    }
+    if (heap_chunk_kind(h, value) == CHUNK_SEGMENT && atomic_load(&h->region_large) > 0)
+    {
+        region_note_store_large(h, slot, value);
+        return;
+    }
+    if (heap_chunk_kind(h, value) != CHUNK_REGION)
+    {
+        return;
+    }
+
+    HeapRegion *r = heap_region_chunk_of(h, value)->region;
+    if (!r)
+    {
+        return;
+    }
+
+    if (in_reserve(h, slot) && heap_chunk_kind(h, slot) == CHUNK_REGION &&
+        heap_region_chunk_of(h, slot)->region == r)
+    {
+        return;
+    }
+
+    atomic_store(&r->escaped, 1);
+}
+
+void heap_store(Heap *h, void **slot, void *value)
+{
+    if (!slot)
+    {
+        return;
+    }
+
+    *slot = value;
+    if (h)
+    {
+        region_note_store(h, slot, value);
+        image_note_store(h, slot, value);
+    }
+}
+
+// zove destroy_heap; memorija chunkova nestaje sa rezervacijom
+void region_destroy_all(Heap *h)
+{
+    while (h->regions)
+    {
+        HeapRegion *r = h->regions;
+        h->regions = r->next;
+        while (r->chunks)
+        {
+            RegionChunk *c = r->chunks;
+            r->chunks = c->next;
+            free(c->seg);
+        }
+        free(r->large);
+        free(r);
+    }
+}
@@ -1,43 +1,139 @@
 #include "heap_state.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
-int roots_add(Heap *h, void **slot)
+#define SLOT_TOMBSTONE ((void **)(uintptr_t)1)
+
+// ------ HES SKUP SLOTOVA -----------
+int slotset_live(void **slot)
 {
-    if (!h || !slot)
+    return slot && slot != SLOT_TOMBSTONE;
+}
+
+static int slotset_grow(SlotSet *s)
+{
+    size_t new_capacity = (s->capacity == 0) ? 16 : s->capacity;
+    if ((s->count + 1) * 2 > new_capacity)
     {
-        return -1;
+        new_capacity *= 2;
     }
 
-    pthread_mutex_lock(&h->lock);
+    void ***ns = (void ***)calloc(new_capacity, sizeof(void **));
+    if (!ns)
+    {
+        return -1;
+    }
 
-    for (size_t i = 0; i < h->roots_count; i++)
+    size_t mask = new_capacity - 1;
+    for (size_t k = 0; k < s->capacity; k++)
     {
-        if (h->roots[i] == slot)
+        void **slot = s->slots[k];
+        if (!slotset_live(slot))
         {
-            pthread_mutex_unlock(&h->lock);
-            return 0;
+            continue;
+        }
+        size_t i = heap_ptr_hash(slot) & mask;
+        while (ns[i])
+        {
+            i = (i + 1) & mask;
         }
+        ns[i] = slot;
     }
 
-    if (h->roots_count == h->roots_capacity)
+    free(s->slots);
+    s->slots = ns;
+    s->capacity = new_capacity;
+    s->used = s->count;
+    return 0;
+}
+
+int slotset_add(SlotSet *s, void **slot)
+{
+    if ((s->used + 1) * 4 > s->capacity * 3)
     {
-        size_t new_capacity = (h->roots_capacity == 0) ? 16 : h->roots_capacity * 2;
-        void ***new_roots = (void ***)realloc(h->roots, new_capacity * sizeof(void **));
-        if (!new_roots)
+        if (slotset_grow(s) != 0)
         {
-            pthread_mutex_unlock(&h->lock);
             return -1;
         }
-        h->roots = new_roots;
-        h->roots_capacity = new_capacity;
     }
 
-    h->roots[h->roots_count++] = slot;
-    pthread_mutex_unlock(&h->lock);
+    size_t mask = s->capacity - 1;
+    size_t i = heap_ptr_hash(slot) & mask;
+    size_t free_at = SIZE_MAX;
+    while (s->slots[i])
+    {
+        if (s->slots[i] == slot)
+        {
+            return 0;
+        }
+        if (s->slots[i] == SLOT_TOMBSTONE && free_at == SIZE_MAX)
+        {
+            free_at = i;
+        }
+        i = (i + 1) & mask;
+    }
 
+    if (free_at == SIZE_MAX)
+    {
+        free_at = i;
+        s->used++;
+    }
+    s->slots[free_at] = slot;
+    s->count++;
     return 0;
 }
 
+int slotset_remove(SlotSet *s, void **slot)
+{
+    if (s->capacity == 0)
+    {
+        return -1;
+    }
+
+    size_t mask = s->capacity - 1;
+    size_t i = heap_ptr_hash(slot) & mask;
+    while (s->slots[i])
+    {
+        if (s->slots[i] == slot)
+        {
+            s->slots[i] = SLOT_TOMBSTONE;
+            s->count--;
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+void slotset_destroy(SlotSet *s)
+{
+    free(s->slots);
+    s->slots = NULL;
+    s->count = 0;
+    s->used = 0;
+    s->capacity = 0;
+}
+
+int roots_add(Heap *h, void **slot)
+{
+    if (!h || !slot)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    int rc = slotset_add(&h->roots, slot);
+    if (rc == 0 && h->trace)
+    {
+        trace_root(h, 1, slot);
+    }
+    heap_unlock(h);
+
+    region_note_store(h, slot, *slot);
+    return rc;
+}
+
 int roots_remove(Heap *h, void **slot)
 {
     if (!h || !slot)
@@ -45,19 +141,170 @@ int roots_remove(Heap *h, void **slot)
         return -1;
     }
 
-    pthread_mutex_lock(&h->lock);
+    heap_lock(h);
+    int rc = slotset_remove(&h->roots, slot);
+    if (rc == 0 && h->trace)
+    {
+        trace_root(h, 0, slot);
+    }
+    heap_unlock(h);
+
+    return rc;
+}
+
+// ------ OKVIRI KORENA (bez zakljucavanja) -----------
+int roots_push_frame(Heap *h, void **slots[], size_t n)
+{
+    ThreadInfo *ti = thread_current(h);
+    if (!ti || (n > 0 && !slots))
+    {
+        return -1;
+    }
+
+    if (ti->frame_depth == ti->frame_depth_cap)
+    {
+        size_t new_cap = (ti->frame_depth_cap == 0) ? 16 : ti->frame_depth_cap * 2;
+        size_t *nf = (size_t *)realloc(ti->frames, new_cap * sizeof(size_t));
+        if (!nf)
+        {
+            return -1;
+        }
+        ti->frames = nf;
+        ti->frame_depth_cap = new_cap;
+    }
 
-    for (size_t i = 0; i < h->roots_count; i++)
+    if (ti->frame_top + n > ti->frame_cap)
     {
-        if (h->roots[i] == slot)
+        size_t new_cap = (ti->frame_cap == 0) ? 64 : ti->frame_cap * 2;
+        while (new_cap < ti->frame_top + n)
         {
-            h->roots[i] = h->roots[h->roots_count - 1];
-            h->roots_count--;
-            pthread_mutex_unlock(&h->lock);
-            return 0;
+            new_cap *= 2;
+        }
+        // bez realloc-a: sakupljac moze zaustaviti nit usred rasta i citati stari niz
+        void ***ns = (void ***)malloc(new_cap * sizeof(void **));
+        if (!ns)
+        {
+            return -1;
+        }
+        void ***old = ti->frame_slots;
+        if (old)
+        {
+            memcpy(ns, old, ti->frame_top * sizeof(void **));
         }
+        ti->frame_slots = ns;
+        atomic_signal_fence(memory_order_seq_cst);
+        ti->frame_cap = new_cap;
+        free(old);
     }
 
-    pthread_mutex_unlock(&h->lock);
-    return -1;
+    size_t top = ti->frame_top;
+    ti->frames[ti->frame_depth++] = top;
+    for (size_t i = 0; i < n; i++)
+    {
+        ti->frame_slots[top + i] = slots[i];
+    }
+    atomic_signal_fence(memory_order_seq_cst);
+    ti->frame_top = top + n;
+    return 0;
+}
+
+int roots_pop_frame(Heap *h)
+{
+    ThreadInfo *ti = thread_current(h);
+    if (!ti || ti->frame_depth == 0)
+    {
+        return -1;
+    }
+
+    ti->frame_top = ti->frames[--ti->frame_depth];
+    return 0;
+}
+
+size_t roots_frame_depth(Heap *h)
+{
+    ThreadInfo *ti = thread_current(h);
+    return ti ? ti->frame_depth : 0;
+}
+
+// ------ OPSEZI ZA SKENIRANJE -----------
+HeapScanRange *heap_add_scan_range(Heap *h, void *lo, void *hi)
+{
+    uintptr_t a = ((uintptr_t)lo + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1);
+    uintptr_t b = (uintptr_t)hi & ~(uintptr_t)(sizeof(void *) - 1);
+    if (!h || !lo || a >= b)
+    {
+        return NULL;
+    }
+
+    HeapScanRange *r = (HeapScanRange *)malloc(sizeof(HeapScanRange));
+    if (!r)
+    {
+        return NULL;
+    }
+    r->lo = (void *)a;
+    r->hi = (void *)b;
+    atomic_init(&r->from, a);
+
+    heap_lock(h);
+    if (h->scan_range_count == h->scan_range_cap)
+    {
+        size_t new_cap = (h->scan_range_cap == 0) ? 16 : h->scan_range_cap * 2;
+        HeapScanRange **nr = (HeapScanRange **)realloc(h->scan_ranges, new_cap * sizeof(HeapScanRange *));
+        if (!nr)
+        {
+            heap_unlock(h);
+            free(r);
+            return NULL;
+        }
+        h->scan_ranges = nr;
+        h->scan_range_cap = new_cap;
+    }
+    r->index = h->scan_range_count;
+    h->scan_ranges[h->scan_range_count++] = r;
+    heap_unlock(h);
+
+    return r;
+}
+
+// poziva se pri svakoj promeni konteksta, pa je samo jedan atomski upis
+void heap_scan_range_set(HeapScanRange *r, void *from)
+{
+    if (r)
+    {
+        atomic_store_explicit(&r->from, (uintptr_t)from, memory_order_release);
+    }
+}
+
+int heap_remove_scan_range(Heap *h, HeapScanRange *r)
+{
+    if (!h || !r)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    if (r->index >= h->scan_range_count || h->scan_ranges[r->index] != r)
+    {
+        heap_unlock(h);
+        return -1;
+    }
+    HeapScanRange *last = h->scan_ranges[--h->scan_range_count];
+    h->scan_ranges[r->index] = last;
+    last->index = r->index;
+    heap_unlock(h);
+
+    free(r);
+    return 0;
+}
+
+void scan_ranges_destroy(Heap *h)
+{
+    for (size_t i = 0; i < h->scan_range_count; i++)
+    {
+        free(h->scan_ranges[i]);
+    }
+    free(h->scan_ranges);
+    h->scan_ranges = NULL;
+    h->scan_range_count = 0;
+    h->scan_range_cap = 0;
 }
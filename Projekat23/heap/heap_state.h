@@ -1,27 +1,200 @@
 #include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include "heap_internal.h"
 #include "heap.h"
 
 _Static_assert(sizeof(size_t) == sizeof(void *), "size_t same size as pointer required");
 
+// signal za zaustavljanje niti tokom GC-a (moze se zameniti sa -DHEAP_SUSPEND_SIGNAL=...)
+#ifndef HEAP_SUSPEND_SIGNAL
+#define HEAP_SUSPEND_SIGNAL SIGUSR2
+#endif
+
+// koliko sakupljac ceka da se nit zaustavi; posle toga odustaje od ciklusa
+#ifndef HEAP_SUSPEND_TIMEOUT_MS
+#define HEAP_SUSPEND_TIMEOUT_MS 1000
+#endif
+
 typedef enum
 {
     THREAD_RUNNING = 0,
-    THREAD_PARKED = 1
+    THREAD_PARKED = 1,
+    THREAD_SUSPENDED = 2,
+    THREAD_NATIVE = 3
 } ThreadStatus;
 
 typedef struct ThreadInfo
 {
     pthread_t tid;
-    ThreadStatus status;
+    atomic_int status;
+    atomic_int suspend_requested;
+    int saved_status;
+    jmp_buf regs;
 
     void *stack_lo;
     void *stack_hi;
     void *sp;
 
+    // poslednji prelaz sa sopstvenog steka na fiber (thread_enter_fiber)
+    jmp_buf native_regs;
+    void *native_sp;
+
+    void ***frame_slots;
+    size_t frame_top;
+    size_t frame_cap;
+    size_t *frames;
+    size_t frame_depth;
+    size_t frame_depth_cap;
+
     struct ThreadInfo *next;
+    struct ThreadInfo *tls_next;
 } ThreadInfo;
 
+typedef struct SlotSet
+{
+    void ***slots;
+    size_t count;
+    size_t used;
+    size_t capacity;
+} SlotSet;
+
+typedef struct EphemeronEntry
+{
+    void *key;
+    void *value;
+} EphemeronEntry;
+
+struct EphemeronTable
+{
+    Heap *heap;
+
+    EphemeronEntry *entries;
+    size_t count;
+    size_t used;
+    size_t capacity;
+
+    struct EphemeronTable *next;
+};
+
+// chunk: 64 KiB poravnato u rezervaciji; mapa heap-a cuva vrstu svakog chunka
+#define HEAP_CHUNK_BYTES ((size_t)64 << 10)
+
+enum
+{
+    CHUNK_SEGMENT = 0,
+    CHUNK_SLAB = 1,
+    CHUNK_REGION = 2,
+    CHUNK_FREE = 3,
+    CHUNK_IMAGE = 4,
+    CHUNK_IMMIX = 5,
+    CHUNK_RELEASED = 6 // slobodan chunk cije su stranice vracene OS-u
+};
+
+// slobodni blokovi po klasama: klasa k drzi payload od (8 << k) do (8 << (k + 1)) - 1 bajtova,
+// poslednja klasa sve vece; trazi se od klase zahteva navise
+#define HEAP_FREE_CLASSES 16
+
+// Immix blok: jedan chunk, [ImmixBlock | linije od 128 bajtova]; objekti imaju obicno
+// zaglavlje i bit u bitmapi pocetaka, ne prelaze granicu bloka, a vece od
+// IMMIX_MAX_OBJECT dobijaju segmente
+#define IMMIX_LINE_BYTES ((size_t)128)
+#define IMMIX_LINES (HEAP_CHUNK_BYTES / IMMIX_LINE_BYTES)
+#define IMMIX_MAX_OBJECT ((size_t)8 << 10)
+
+typedef struct ImmixBlock ImmixBlock;
+struct ImmixBlock
+{
+    ImmixBlock *next;       // svi blokovi heap-a
+    ImmixBlock *next_avail; // blokovi sa slobodnim linijama
+    size_t free_lines;      // posle poslednjeg sweep-a
+    int evacuate;           // kandidat za praznjenje u ovom ciklusu
+    int released;           // heap_trim: chunk se vraca OS-u
+    unsigned char line_mark[IMMIX_LINES];
+};
+
+#define IMMIX_FIRST_LINE ((sizeof(ImmixBlock) + IMMIX_LINE_BYTES - 1) / IMMIX_LINE_BYTES)
+#define IMMIX_USABLE_LINES (IMMIX_LINES - IMMIX_FIRST_LINE)
+
+// slab: jedan chunk, [Slab | alloc bitmapa | mark bitmapa | objekti]
+#define HEAP_SLAB_BYTES HEAP_CHUNK_BYTES
+#define HEAP_POOL_MAX_OBJ ((size_t)1024)
+
+typedef struct Slab
+{
+    HeapPool *pool;
+    struct Slab *next;
+    struct Slab *next_partial;
+    int in_partial;
+
+    unsigned char *objs;
+    size_t obj_size;
+    size_t count;
+    size_t free_count;
+    size_t hint;
+
+    uint64_t *alloc_bits;
+    uint64_t *mark_bits;
+    size_t words;
+} Slab;
+
+struct HeapPool
+{
+    Heap *heap;
+    size_t obj_size;
+
+    Slab *slabs;
+    Slab *partial;
+
+    struct HeapPool *next;
+};
+
+// region: chunk pocinje blokom (NOSCAN) ciji je payload RegionChunk, zatim bump objekti
+typedef struct RegionChunk
+{
+    HeapRegion *region;
+    struct RegionChunk *next;
+    unsigned char *top;
+    Segment *seg;
+} RegionChunk;
+
+struct HeapRegion
+{
+    Heap *heap;
+    RegionChunk *chunks;
+    atomic_int escaped;
+    // objekti veci od chunka: obicni blokovi segmenta, zivi dok je region otvoren
+    void **large;
+    size_t large_count;
+    size_t large_cap;
+
+    struct HeapRegion *next;
+};
+
+// opseg [lo, hi) koji se skenira konzervativno od from; from == 0: iskljucen
+struct HeapScanRange
+{
+    void *lo;
+    void *hi;
+    atomic_uintptr_t from;
+    size_t index; // mesto u h->scan_ranges
+};
+
+typedef struct FinalEntry
+{
+    void *obj;
+    HeapFinalizer fn;
+} FinalEntry;
+
+typedef struct PressureCallback
+{
+    HeapPressureFn fn;
+    void *ctx;
+} PressureCallback;
+
+typedef struct HeapTrace HeapTrace;
+
 struct Heap
 {
     size_t segment_size_bytes;
@@ -29,18 +202,316 @@ struct Heap
 
     pthread_mutex_t lock;
 
+    void *reserve_base;
+    size_t reserve_len;
+    unsigned char *reserve_lo;
+    unsigned char *reserve_hi;
+    unsigned char *reserve_top;
+    size_t segment_align;
+    int huge_pages;
+
     Segment *segments;
-    BlockHeader *free_list;
+    BlockHeader *free_lists[HEAP_FREE_CLASSES];
 
     size_t allocated_bytes;
 
-    void ***roots;
-    size_t roots_count;
-    size_t roots_capacity;
+    SlotSet roots;
+    SlotSet weak;
+
+    EphemeronTable *ephemerons;
+
+    unsigned char *chunk_map;
+    size_t chunk_map_len; // cela mapa: chunk_map + block_starts
+    // bit po reci rezervacije: 1 gde pocinje zaglavlje bloka u segmentu
+    uint64_t *block_starts;
+    void *free_chunks;
+    HeapPool *pools;
+    HeapRegion *regions;
+    atomic_int region_large; // broj velikih objekata otvorenih regiona (brzi put heap_store)
+    HeapTrace *trace;
+
+    int engine;
+    int single_thread;
+    ImmixBlock *immix_blocks;
+    ImmixBlock *immix_avail;
+    ImmixBlock *immix_cur;  // blok u kom se trazi sledeca rupa
+    size_t immix_line;      // prva linija immix_cur koja jos nije pregledana
+    unsigned char *immix_cursor;
+    unsigned char *immix_limit;
+    // prazan blok za srednje objekte koji ne staju u tekucu rupu
+    unsigned char *immix_ovf_cursor;
+    unsigned char *immix_ovf_limit;
+
+    HeapScanRange **scan_ranges;
+    size_t scan_range_count;
+    size_t scan_range_cap;
+
+    // slotovi u slici heap-a u koje je heap_store upisao pokazivac u heap
+    SlotSet image_slots;
+    // reci ucitane slike koje su bile pokazivaci (indeksi od reserve_lo); heap_save
+    // relocira samo njih i image_slots, pa podaci u slici ostaju netaknuti
+    uint64_t *image_relocs;
+    size_t image_reloc_count;
 
     ThreadInfo *threads;
-    pthread_cond_t gc_cond;
-    int gc_requested;
+    atomic_int gc_requested;
+
+    pthread_t collector;
+    pthread_mutex_t gc_req_lock;
+    pthread_cond_t gc_req_cond;
+    GcTicket gc_cycle_requested;
+    GcTicket gc_cycle_started;
+    GcTicket gc_cycle_done;
+    int collector_stop;
+
+    // finalizacija (heap_final.c): registar je pod lock-om heap-a, red i batch u toku
+    // pod final_lock; nit finalizatora se pravi pri prvoj finalizabilnoj alokaciji.
+    // GC uzima final_lock tokom pauze, pa ga registrovana nit drzi samo u native stanju
+    // ili dok drzi lock heap-a (vidi final_lock_take)
+    FinalEntry *finals;
+    size_t final_count;
+    size_t final_cap;
+    int final_started;
+    pthread_mutex_t final_lock;
+    pthread_cond_t final_cond;
+    FinalEntry *final_queue;
+    size_t final_queue_len;
+    size_t final_queue_cap;
+    FinalEntry *final_batch;
+    size_t final_batch_len;
+    size_t final_batch_cap;
+    pthread_t finalizer;
+    int finalizer_stop;
+    int final_running; // final_run_pending u toku na final_runner (ugnjezdeni poziv se vraca)
+    pthread_t final_runner;
+
+    // memorija uzeta od OS-a (reserve_commit), bez stranica koje je vratio heap_trim
+    size_t committed_bytes;
+    size_t soft_limit_bytes;
+    size_t hard_limit_bytes;
+    int pressure_fired; // histerezis: pozivi ne idu ponovo dok heap ne padne ispod 7/8 meke granice
+    atomic_int pressure_pending;
+    atomic_int pressure_collect; // ciklus za prelaz meke granice, trazi se van lock-a i pauze
+    PressureCallback *pressure_cbs;
+    size_t pressure_count;
+    size_t pressure_cap;
+
+    // najveci zahtev koji try_alloc_heap nije mogao da ispuni od poslednjeg ciklusa
+    atomic_size_t try_miss_bytes;
 };
 
+// segmenti su uzastopni u rezervaciji: [reserve_lo, reserve_top)
+static inline int heap_contains(const Heap *h, const void *p)
+{
+    const unsigned char *x = (const unsigned char *)p;
+    return x >= h->reserve_lo && x < h->reserve_top;
+}
+
+// p mora biti u rezervaciji (heap_contains)
+static inline unsigned char heap_chunk_kind(const Heap *h, const void *p)
+{
+    return h->chunk_map[(size_t)((const unsigned char *)p - h->reserve_lo) / HEAP_CHUNK_BYTES];
+}
+
+static inline unsigned char *heap_chunk_base(const Heap *h, const void *p)
+{
+    size_t i = (size_t)((const unsigned char *)p - h->reserve_lo) / HEAP_CHUNK_BYTES;
+    return h->reserve_lo + i * HEAP_CHUNK_BYTES;
+}
+
+static inline Slab *heap_slab_of(const Heap *h, const void *p)
+{
+    return heap_chunk_kind(h, p) == CHUNK_SLAB ? (Slab *)(void *)heap_chunk_base(h, p) : NULL;
+}
+
+static inline RegionChunk *heap_region_chunk_of(const Heap *h, const void *p)
+{
+    return (RegionChunk *)(void *)(heap_chunk_base(h, p) + sizeof(BlockHeader));
+}
+
+static inline size_t heap_word_index(const Heap *h, const void *p)
+{
+    return (size_t)((const unsigned char *)p - h->reserve_lo) / HEAP_ALIGNMENT;
+}
+
+static inline void block_start_set(Heap *h, const BlockHeader *b)
+{
+    size_t i = heap_word_index(h, b);
+    h->block_starts[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static inline void block_start_clear(Heap *h, const BlockHeader *b)
+{
+    size_t i = heap_word_index(h, b);
+    h->block_starts[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+static inline int block_start_test(const Heap *h, const BlockHeader *b)
+{
+    if ((uintptr_t)b & (HEAP_ALIGNMENT - 1))
+    {
+        return 0;
+    }
+    size_t i = heap_word_index(h, b);
+    return (h->block_starts[i / 64] >> (i % 64)) & 1;
+}
+
+static inline size_t free_class(size_t size)
+{
+    size_t g = size / HEAP_ALIGNMENT;
+    size_t k = g > 1 ? (size_t)(63 - __builtin_clzll((unsigned long long)g)) : 0;
+    return k < HEAP_FREE_CLASSES ? k : HEAP_FREE_CLASSES - 1;
+}
+
+// lista u koju ide slobodan blok date velicine
+static inline BlockHeader **free_list_of(Heap *h, size_t size)
+{
+    return &h->free_lists[free_class(size)];
+}
+
+static inline ImmixBlock *immix_block_of(const Heap *h, const void *p)
+{
+    return (ImmixBlock *)(void *)heap_chunk_base(h, p);
+}
+
+// linije koje objekat zauzima (od zaglavlja do kraja payload-a)
+static inline void immix_mark_lines(ImmixBlock *blk, const BlockHeader *b)
+{
+    size_t first = (size_t)((const unsigned char *)b - (const unsigned char *)blk) / IMMIX_LINE_BYTES;
+    size_t last = (size_t)((const unsigned char *)(b + 1) + b->size - 1 - (const unsigned char *)blk) / IMMIX_LINE_BYTES;
+    for (size_t i = first; i <= last; i++)
+    {
+        blk->line_mark[i] = 1;
+    }
+}
+
+// indeks objekta u slabu ili (size_t)-1 ako p nije pocetak zivog objekta
+static inline size_t slab_index(const Slab *s, const void *p)
+{
+    const unsigned char *x = (const unsigned char *)p;
+    if (!s->pool || x < s->objs)
+    {
+        return (size_t)-1;
+    }
+    size_t off = (size_t)(x - s->objs);
+    size_t i = off / s->obj_size;
+    if (i >= s->count || i * s->obj_size != off || !(s->alloc_bits[i / 64] & ((uint64_t)1 << (i % 64))))
+    {
+        return (size_t)-1;
+    }
+    return i;
+}
+
+int  slotset_live(void **slot);
+int  slotset_add(SlotSet *s, void **slot);
+int  slotset_remove(SlotSet *s, void **slot);
+void slotset_destroy(SlotSet *s);
+void scan_ranges_destroy(Heap *h);
+
+// jednonitni heap: lock i zaustavljanje niti se preskacu
+#ifdef HEAP_SINGLE_THREADED
+#define heap_single(h) ((void)(h), 1)
+#else
+#define heap_single(h) ((h)->single_thread)
+#endif
+
+// ------ REDOSLED ZAKLJUCAVANJA -----------
+// h->lock -> gc_req_lock, h->lock -> final_lock. Sakupljac drzi h->lock tokom cele
+// pauze i u njoj uzima final_lock (mark_finalizable), a gc_req_lock ne uzima. Zato
+// registrovana nit sme da drzi final_lock samo:
+//   - u native stanju (sakupljac je ne zaustavlja signalom), ili
+//   - dok drzi h->lock (pauza tada ne moze da pocne).
+// Nit u RUNNING stanju bi signal zaustavio sa final_lock u ruci, a pauza bi cekala
+// na njega zauvek. final_lock_take to proverava u debug build-u.
+#ifndef NDEBUG
+extern __thread Heap *heap_lock_owner; // heap ciji lock drzi ova nit
+#define heap_lock_note(h) (heap_lock_owner = (h))
+#else
+#define heap_lock_note(h) ((void)0)
+#endif
+
+static inline void heap_unlock(Heap *h)
+{
+    if (!heap_single(h))
+    {
+        heap_lock_note(NULL);
+        pthread_mutex_unlock(&h->lock);
+    }
+}
+
+static inline int heap_trylock(Heap *h)
+{
+    if (heap_single(h))
+    {
+        return 0;
+    }
+    int rc = pthread_mutex_trylock(&h->lock);
+    if (rc == 0)
+    {
+        heap_lock_note(h);
+    }
+    return rc;
+}
+
+ThreadInfo *thread_current(Heap *h);
+void heap_lock(Heap *h);
+int threads_suspend(Heap *h);
+void threads_resume(Heap *h);
+void thread_save_context(ThreadInfo *ti);
+void thread_unpark(Heap *h, ThreadInfo *ti);
+
+void collect_now(Heap *h);
+int  collector_start(Heap *h);
+void collector_stop(Heap *h);
+
+void heap_refill(Heap *h, size_t size_bytes);
+void collect_request_nowait(Heap *h);
+Heap *heap_create_image(const HeapConfig *cfg, void *hint, size_t image_bytes);
+void *reserve_commit(Heap *h, size_t size);
+unsigned char *chunk_take(Heap *h, unsigned char kind);
+void chunk_give(Heap *h, void *chunk);
+int heap_pages_release(void *p, size_t size);
+void chunk_release(Heap *h, void *chunk);
+void block_reclaim(Heap *h, BlockHeader *b);
+void heap_pressure_check(Heap *h);
+void heap_pressure_run(Heap *h);
+void free_locked(Heap *h, void *ptr);
+void pool_free_locked(Heap *h, void *obj);
+void pool_destroy_all(Heap *h);
+void region_note_store(Heap *h, void **slot, void *value);
+void region_forget_large(Heap *h, void *obj);
+void region_destroy_all(Heap *h);
+void image_note_store(Heap *h, void **slot, void *value);
+
+// finalizacija (heap_final.c)
+int  final_start(Heap *h);
+void final_stop(Heap *h);
+int  final_reserve(Heap *h);
+void final_forget(Heap *h, void *obj);
+void final_lock_take(Heap *h);
+int  final_enqueue(Heap *h, FinalEntry e);
+void final_notify(Heap *h);
+void final_run_pending(Heap *h);
+
+// Immix (heap_immix.c); sve pod lock-om heap-a
+BlockHeader *immix_alloc(Heap *h, size_t req, uint32_t flags, int grow);
+int immix_refill(Heap *h, size_t req);
+void immix_free_locked(Heap *h, BlockHeader *b);
+void immix_prepare(Heap *h);
+void immix_sweep(Heap *h);
+void immix_evacuate(Heap *h);
+size_t immix_trim(Heap *h);
+void immix_for_each_object(Heap *h, void (*fn)(Heap *h, BlockHeader *b, void *ctx), void *ctx);
+
+// trag alokacija (heap_trace.c); zovu se pod lock-om samo kad je h->trace postavljen
+void trace_alloc(Heap *h, void *p, size_t size);
+void trace_free(Heap *h, void *p);
+void trace_gc_free(Heap *h, void *p);
+void trace_root(Heap *h, int add, void **slot);
+void trace_move(Heap *h, void *from, void *to);
+void trace_collect(Heap *h);
+
+int  ephemeron_entry_live(const EphemeronEntry *e);
+void ephemeron_entry_clear(EphemeronTable *t, EphemeronEntry *e);
+
 
@@ -1,29 +1,244 @@
 #include "heap_state.h"
+#include <errno.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <time.h>
 
+static __thread Heap *tls_heap = NULL;
+static __thread ThreadInfo *tls_thread = NULL;
+
+// sve ThreadInfo strukture ove niti (po jedna za svaki heap), za signal handler
+static __thread ThreadInfo *tls_chain = NULL;
+static __thread int tls_in_suspend = 0;
+
+static pthread_once_t suspend_once = PTHREAD_ONCE_INIT;
+static int suspend_installed = 0;
+
+#ifndef NDEBUG
+__thread Heap *heap_lock_owner = NULL;
+#endif
+
+// ZAKLJUCAVANJE HEAP-A: nit koja ceka na lock je bezbedna za GC, pa se parkira
+void heap_lock(Heap *h)
+{
+    if (heap_single(h))
+        return;
+
+    if (heap_trylock(h) == 0)
+        return;
+
+    ThreadInfo *ti = (tls_heap == h) ? tls_thread : NULL;
+    if (!ti || atomic_load(&ti->status) != THREAD_RUNNING)
+    {
+        pthread_mutex_lock(&h->lock);
+        heap_lock_note(h);
+        return;
+    }
+
+    thread_save_context(ti);
+    atomic_store(&ti->status, THREAD_PARKED);
+    pthread_mutex_lock(&h->lock);
+    heap_lock_note(h);
+    atomic_store(&ti->status, THREAD_RUNNING);
+}
+
+// TRENUTNA NIT (kes po niti, bez zakljucavanja)
+ThreadInfo *thread_current(Heap *h)
+{
+    if (!h)
+        return NULL;
+
+    if (tls_heap == h)
+        return tls_thread;
+
+    pthread_t self = pthread_self();
+
+    heap_lock(h);
+    ThreadInfo *ti = h->threads;
+    while (ti && !pthread_equal(ti->tid, self))
+        ti = ti->next;
+    heap_unlock(h);
+
+    if (ti)
+    {
+        tls_heap = h;
+        tls_thread = ti;
+    }
+    return ti;
+}
+
+// ------ ZAUSTAVLJANJE NITI SIGNALOM -----------
+static void suspend_handler(int sig)
+{
+    (void)sig;
+
+    // ugnjezden poziv je samo budjenje iz sigsuspend-a ispod
+    if (tls_in_suspend)
+        return;
+
+    int saved_errno = errno;
+    tls_in_suspend = 1;
+
+    // kernel je registre prekinute niti sacuvao na steku iznad ovog okvira
+    void *sp = __builtin_frame_address(0);
+
+    sigset_t mask;
+    pthread_sigmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, HEAP_SUSPEND_SIGNAL);
+
+    for (;;)
+    {
+        int waiting = 0;
+        for (ThreadInfo *ti = tls_chain; ti; ti = ti->tls_next)
+        {
+            int st = atomic_load(&ti->status);
+            if (atomic_load(&ti->suspend_requested))
+            {
+                if (st != THREAD_SUSPENDED)
+                {
+                    if (st == THREAD_RUNNING)
+                        ti->sp = sp;
+                    ti->saved_status = st;
+                    atomic_store(&ti->status, THREAD_SUSPENDED);
+                }
+                waiting = 1;
+            }
+            else if (st == THREAD_SUSPENDED)
+            {
+                atomic_store(&ti->status, ti->saved_status);
+            }
+        }
+
+        if (!waiting)
+            break;
+        sigsuspend(&mask);
+    }
+
+    tls_in_suspend = 0;
+    errno = saved_errno;
+}
+
+static void suspend_install(void)
+{
+    struct sigaction sa;
+    sa.sa_handler = suspend_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    suspend_installed = sigaction(HEAP_SUSPEND_SIGNAL, &sa, NULL) == 0;
+}
+
+static double suspend_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// poziva sakupljac dok drzi h->lock i gc_requested je postavljen. -1 ako se neka nit
+// ne zaustavi za HEAP_SUSPEND_TIMEOUT_MS (signal blokiran posle thread_register);
+// tada su ostale niti vec pustene i ciklus se preskace
+int threads_suspend(Heap *h)
+{
+    pthread_t self = pthread_self();
+
+    for (ThreadInfo *ti = h->threads; ti; ti = ti->next)
+    {
+        if (pthread_equal(ti->tid, self) || atomic_load(&ti->status) != THREAD_RUNNING)
+            continue;
+
+        atomic_store(&ti->suspend_requested, 1);
+        if (pthread_kill(ti->tid, HEAP_SUSPEND_SIGNAL) != 0)
+            atomic_store(&ti->suspend_requested, 0);
+    }
+
+    // nit moze i sama da se parkira pre nego sto stigne signal
+    double deadline = suspend_now_ms() + HEAP_SUSPEND_TIMEOUT_MS;
+    for (ThreadInfo *ti = h->threads; ti; ti = ti->next)
+    {
+        while (atomic_load(&ti->suspend_requested) && atomic_load(&ti->status) == THREAD_RUNNING)
+        {
+            if (suspend_now_ms() > deadline)
+            {
+                // signal ostaje na cekanju; kad stigne, handler ne vidi zahtev i vraca se
+                threads_resume(h);
+                return -1;
+            }
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+void threads_resume(Heap *h)
+{
+    for (ThreadInfo *ti = h->threads; ti; ti = ti->next)
+    {
+        if (atomic_load(&ti->suspend_requested))
+        {
+            atomic_store(&ti->suspend_requested, 0);
+            pthread_kill(ti->tid, HEAP_SUSPEND_SIGNAL);
+        }
+    }
+
+    // nit koja jos spava bi sledeci ciklus videla kao zaustavljenu
+    for (ThreadInfo *ti = h->threads; ti; ti = ti->next)
+    {
+        while (atomic_load(&ti->status) == THREAD_SUSPENDED)
+            sched_yield();
+    }
+}
+
+// registri i vrh steka pre blokiranja; noinline da ceo okvir pozivaoca bude iznad sp
+__attribute__((noinline)) void thread_save_context(ThreadInfo *ti)
+{
+    setjmp(ti->regs);
+    ti->sp = __builtin_frame_address(0);
+}
+
+// sakupljac drzi h->lock tokom celog ciklusa, pa parkirana nit ceka na njemu
+void thread_unpark(Heap *h, ThreadInfo *ti)
+{
+    pthread_mutex_lock(&h->lock);
+    atomic_store(&ti->status, THREAD_RUNNING);
+    pthread_mutex_unlock(&h->lock);
+}
 
 int thread_register(Heap *h)
 {
     if (!h)
         return -1;
 
+    pthread_once(&suspend_once, suspend_install);
+    if (!suspend_installed)
+        return -1;
+
+    // sakupljac ne bi mogao da zaustavi nit koja blokira signal
+    sigset_t mask;
+    if (pthread_sigmask(SIG_BLOCK, NULL, &mask) != 0 || sigismember(&mask, HEAP_SUSPEND_SIGNAL))
+        return -1;
+
     ThreadInfo *ti = calloc(1, sizeof(ThreadInfo));
     if (!ti)
         return -1;
 
     ti->tid = pthread_self();
-    ti->status = THREAD_RUNNING;
-
+    atomic_init(&ti->status, THREAD_RUNNING);
+    atomic_init(&ti->suspend_requested, 0);
 
     void *stack_hi = pthread_get_stackaddr_np(ti->tid);
     size_t stack_size = pthread_get_stacksize_np(ti->tid);
     ti->stack_hi = stack_hi;
     ti->stack_lo = (char *)stack_hi - stack_size;
 
-    pthread_mutex_lock(&h->lock);
+    heap_lock(h);
     ti->next = h->threads;
     h->threads = ti;
-    pthread_mutex_unlock(&h->lock);
+    ti->tls_next = tls_chain;
+    tls_chain = ti;
+    heap_unlock(h);
+
+    tls_heap = h;
+    tls_thread = ti;
 
     return 0;
 }
@@ -35,7 +250,7 @@ int thread_unregister(Heap *h)
 
     pthread_t self = pthread_self();
 
-    pthread_mutex_lock(&h->lock);
+    heap_lock(h);
     ThreadInfo **pp = &h->threads;
     while (*pp)
     {
@@ -43,50 +258,94 @@ int thread_unregister(Heap *h)
         {
             ThreadInfo *dead = *pp;
             *pp = dead->next;
+
+            ThreadInfo **cp = &tls_chain;
+            while (*cp && *cp != dead)
+                cp = &(*cp)->tls_next;
+            if (*cp)
+                *cp = dead->tls_next;
+
+            free(dead->frame_slots);
+            free(dead->frames);
             free(dead);
             break;
         }
         pp = &(*pp)->next;
     }
-    pthread_mutex_unlock(&h->lock);
+    heap_unlock(h);
+
+    if (tls_heap == h)
+    {
+        tls_heap = NULL;
+        tls_thread = NULL;
+    }
     return 0;
 }
 
 void gc_safepoint(Heap *h)
 {
-    if (!h)
+    if (!h || heap_single(h))
         return;
 
-    pthread_mutex_lock(&h->lock);
+    if (!atomic_load(&h->gc_requested))
+        return;
 
-    if (!h->gc_requested)
-    {
-        pthread_mutex_unlock(&h->lock);
+    ThreadInfo *ti = thread_current(h);
+    if (!ti)
         return;
-    }
 
-    pthread_t self = pthread_self();
-    ThreadInfo *ti = h->threads;
-    while (ti)
-    {
-        if (pthread_equal(ti->tid, self))
-        {
-            ti->status = THREAD_PARKED;
-            ti->sp = __builtin_frame_address(0);
-            break;
-        }
-        ti = ti->next;
-    }
+    thread_save_context(ti);
+    atomic_store(&ti->status, THREAD_PARKED);
+    thread_unpark(h, ti);
+}
 
-    pthread_cond_broadcast(&h->gc_cond);
+// ------ NATIVE STANJE -----------
+// nit u dugom sistemskom pozivu ne dira GC objekte; sakupljac je ne ceka
+void thread_enter_native(Heap *h)
+{
+    if (h && heap_single(h))
+        return;
 
-    while (h->gc_requested)
-    {
-        pthread_cond_wait(&h->gc_cond, &h->lock);
-    }
+    ThreadInfo *ti = thread_current(h);
+    if (!ti)
+        return;
 
-    if (ti)
-        ti->status = THREAD_RUNNING;
+    thread_save_context(ti);
+    atomic_store(&ti->status, THREAD_NATIVE);
+}
 
-    pthread_mutex_unlock(&h->lock);
+void thread_leave_native(Heap *h)
+{
+    if (h && heap_single(h))
+        return;
+
+    ThreadInfo *ti = thread_current(h);
+    if (!ti)
+        return;
+
+    // sakupljac prvo postavlja gc_requested pa cita statuse; nit obrnuto
+    atomic_store(&ti->status, THREAD_RUNNING);
+    if (!atomic_load(&h->gc_requested))
+        return;
+
+    atomic_store(&ti->status, THREAD_PARKED);
+    thread_unpark(h, ti);
+}
+
+// ------ FIBERI -----------
+// poziva se na sopstvenom steku niti, neposredno pre prelaska na fiber. Dok nit radi
+// na fiberu njen sp nije na tom steku, pa se stek skenira od ovde sacuvanog sp
+__attribute__((noinline)) void thread_enter_fiber(Heap *h)
+{
+    ThreadInfo *ti = thread_current(h);
+    if (!ti)
+        return;
+
+    // sa fibera na fiber: vazi prelaz sa sopstvenog steka
+    char *sp = (char *)__builtin_frame_address(0);
+    if (sp < (char *)ti->stack_lo || sp >= (char *)ti->stack_hi)
+        return;
+
+    setjmp(ti->native_regs);
+    ti->native_sp = sp;
 }
@@ -0,0 +1,227 @@
+#include "heap_state.h"
+#include "heap_trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_BUF_BYTES ((size_t)64 << 10)
+#define TRACE_EVENT_MAX 48
+
+// bafer se puni samo pod lock-om heap-a; pise se direktno sa write() jer
+// sweep belezi dogadjaje dok su niti zaustavljene (bez malloc-a i stdio lock-ova)
+struct HeapTrace
+{
+    int fd;
+    int failed;
+    size_t len;
+    unsigned char buf[TRACE_BUF_BYTES];
+};
+
+static atomic_uint trace_next_tid = 1;
+static __thread unsigned tls_trace_tid = 0;
+
+static unsigned trace_tid(void)
+{
+    if (tls_trace_tid == 0)
+    {
+        tls_trace_tid = atomic_fetch_add(&trace_next_tid, 1);
+    }
+    return tls_trace_tid;
+}
+
+// ------ PISANJE -----------
+static void trace_flush(HeapTrace *t)
+{
+    size_t off = 0;
+    while (!t->failed && off < t->len)
+    {
+        ssize_t n = write(t->fd, t->buf + off, t->len - off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            t->failed = 1;
+            break;
+        }
+        off += (size_t)n;
+    }
+    t->len = 0;
+}
+
+// NULL ako trag nije ukljucen ili je pisanje vec palo
+static HeapTrace *trace_begin(Heap *h, unsigned char op)
+{
+    HeapTrace *t = h->trace;
+    if (!t || t->failed)
+    {
+        return NULL;
+    }
+    if (t->len + TRACE_EVENT_MAX > TRACE_BUF_BYTES)
+    {
+        trace_flush(t);
+    }
+    t->buf[t->len++] = op;
+    return t;
+}
+
+static void trace_varint(HeapTrace *t, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        t->buf[t->len++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    t->buf[t->len++] = (unsigned char)v;
+}
+
+static uint64_t trace_addr(const Heap *h, const void *p)
+{
+    return (uint64_t)((const unsigned char *)p - h->reserve_lo) / HEAP_ALIGNMENT;
+}
+
+// ------ DOGADJAJI (pod lock-om heap-a) -----------
+void trace_alloc(Heap *h, void *p, size_t size)
+{
+    HeapTrace *t = trace_begin(h, TRACE_ALLOC);
+    if (t)
+    {
+        trace_varint(t, trace_tid());
+        trace_varint(t, trace_addr(h, p));
+        trace_varint(t, size);
+    }
+}
+
+void trace_free(Heap *h, void *p)
+{
+    HeapTrace *t = trace_begin(h, TRACE_FREE);
+    if (t)
+    {
+        trace_varint(t, trace_tid());
+        trace_varint(t, trace_addr(h, p));
+    }
+}
+
+void trace_gc_free(Heap *h, void *p)
+{
+    HeapTrace *t = trace_begin(h, TRACE_GC_FREE);
+    if (t)
+    {
+        trace_varint(t, trace_addr(h, p));
+    }
+}
+
+void trace_move(Heap *h, void *from, void *to)
+{
+    HeapTrace *t = trace_begin(h, TRACE_MOVE);
+    if (t)
+    {
+        trace_varint(t, trace_addr(h, from));
+        trace_varint(t, trace_addr(h, to));
+    }
+}
+
+void trace_root(Heap *h, int add, void **slot)
+{
+    HeapTrace *t = trace_begin(h, add ? TRACE_ROOT_ADD : TRACE_ROOT_DEL);
+    if (!t)
+    {
+        return;
+    }
+
+    trace_varint(t, trace_tid());
+    trace_varint(t, (uint64_t)(uintptr_t)slot / 8);
+    if (add)
+    {
+        void *v = *slot;
+        trace_varint(t, (v && heap_contains(h, v)) ? trace_addr(h, v) + 1 : 0);
+    }
+}
+
+void trace_collect(Heap *h)
+{
+    HeapTrace *t = trace_begin(h, TRACE_COLLECT);
+    if (t)
+    {
+        trace_varint(t, trace_tid());
+    }
+}
+
+// ------ UKLJUCIVANJE -----------
+int heap_trace_start(Heap *h, const char *path)
+{
+    if (!h || !path)
+    {
+        return -1;
+    }
+
+    // provera pre open(): O_TRUNC bi obrisao trag koji se vec pise
+    heap_lock(h);
+    int busy = h->trace != NULL;
+    heap_unlock(h);
+    if (busy)
+    {
+        return -1;
+    }
+
+    HeapTrace *t = (HeapTrace *)malloc(sizeof(HeapTrace));
+    if (!t)
+    {
+        return -1;
+    }
+
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (t->fd < 0)
+    {
+        free(t);
+        return -1;
+    }
+    t->failed = 0;
+    memcpy(t->buf, HEAP_TRACE_MAGIC, 4);
+    t->buf[4] = HEAP_TRACE_VERSION;
+    t->len = 5;
+
+    heap_lock(h);
+    if (h->trace)
+    {
+        heap_unlock(h);
+        close(t->fd);
+        free(t);
+        return -1;
+    }
+    h->trace = t;
+    heap_unlock(h);
+
+    return 0;
+}
+
+int heap_trace_stop(Heap *h)
+{
+    if (!h)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    HeapTrace *t = h->trace;
+    h->trace = NULL;
+    heap_unlock(h);
+
+    if (!t)
+    {
+        return -1;
+    }
+
+    trace_flush(t);
+    int rc = t->failed ? -1 : 0;
+    if (close(t->fd) != 0)
+    {
+        rc = -1;
+    }
+    free(t);
+
+    return rc;
+}
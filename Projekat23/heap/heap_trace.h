@@ -0,0 +1,33 @@
+#ifndef HEAP_TRACE_H
+#define HEAP_TRACE_H
+
+// format traga (heap_trace_start): zaglavlje "HTRC" + bajt verzije, zatim dogadjaji
+// redom kojim su se desili pod lock-om heap-a: bajt op + polja kao LEB128 varint
+//
+//   TRACE_ALLOC     tid addr size
+//   TRACE_FREE      tid addr
+//   TRACE_GC_FREE   addr            (sweep je oslobodio objekat)
+//   TRACE_ROOT_ADD  tid slot value  (value = addr + 1, 0 ako slot ne pokazuje na objekat)
+//   TRACE_ROOT_DEL  tid slot
+//   TRACE_COLLECT   tid             (kraj ciklusa, posle njegovih GC_FREE dogadjaja)
+//   TRACE_MOVE      from to         (Immix je premestio objekat; od verzije 2)
+//
+// addr = (objekat - pocetak rezervacije) / HEAP_ALIGNMENT; slot = adresa slota / 8
+// realloc_heap u mestu se belezi kao TRACE_FREE pa TRACE_ALLOC iste adrese
+// tid je redni broj niti u procesu (od 1), dodeljen pri prvom dogadjaju te niti
+
+#define HEAP_TRACE_MAGIC "HTRC"
+#define HEAP_TRACE_VERSION 2
+
+enum
+{
+    TRACE_ALLOC = 1,
+    TRACE_FREE = 2,
+    TRACE_GC_FREE = 3,
+    TRACE_ROOT_ADD = 4,
+    TRACE_ROOT_DEL = 5,
+    TRACE_COLLECT = 6,
+    TRACE_MOVE = 7
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "heap_state.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void free_list_push(BlockHeader **head, BlockHeader *block)
+{
+    block_set_next_free(block, *head);
+    *head = block;
+}
+
+// ------ STRANICE SLOBODNIH BLOKOVA -----------
+// cele stranice payload-a posle prve reci (veza liste slobodnih)
+static size_t released_span(const BlockHeader *b, uintptr_t *lo, uintptr_t *hi)
+{
+    static size_t page = 0;
+    if (page == 0)
+    {
+        page = (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    uintptr_t p = (uintptr_t)(const void *)(b + 1);
+    *lo = (p + sizeof(void *) + page - 1) & ~(uintptr_t)(page - 1);
+    *hi = (p + b->size) & ~(uintptr_t)(page - 1);
+    return *hi > *lo ? (size_t)(*hi - *lo) : 0;
+}
+
+// blok ponovo ulazi u heap (alokacija, spajanje): njegove stranice se opet racunaju
+void block_reclaim(Heap *h, BlockHeader *b)
+{
+    if (b->flags & BLOCK_FLAG_RELEASED)
+    {
+        uintptr_t lo;
+        uintptr_t hi;
+        h->committed_bytes += released_span(b, &lo, &hi);
+        b->flags &= ~BLOCK_FLAG_RELEASED;
+        heap_pressure_check(h);
+    }
+}
+
+// stranice se vracaju OS-u novim anonimnim mapiranjem preko njih: nule su zagarantovane
+// i na Darwin-u (MADV_DONTNEED tamo ne nulira). Ivice se nuliraju rucno pa je ceo blok ZEROED
+static void block_release(Heap *h, BlockHeader *b)
+{
+    uintptr_t lo;
+    uintptr_t hi;
+    size_t span = released_span(b, &lo, &hi);
+    if (span == 0 || !heap_pages_release((void *)lo, span))
+    {
+        return;
+    }
+
+    if (!(b->flags & BLOCK_FLAG_ZEROED))
+    {
+        unsigned char *p = (unsigned char *)(void *)(b + 1);
+        memset(p + sizeof(void *), 0, (size_t)((unsigned char *)lo - p) - sizeof(void *));
+        memset((void *)hi, 0, (size_t)(p + b->size - (unsigned char *)hi));
+    }
+    b->flags |= BLOCK_FLAG_RELEASED | BLOCK_FLAG_ZEROED;
+    h->committed_bytes -= span;
+}
+
+// spaja susedne slobodne blokove segmenta i vraca ih u (prazne) liste
+static void trim_segment(Heap *h, Segment *seg)
+{
+    unsigned char *cur = seg->mem;
+    unsigned char *end = seg->mem + seg->size;
+    while (cur + sizeof(BlockHeader) <= end)
+    {
+        BlockHeader *b = (BlockHeader *)(void *)cur;
+        if (!block_start_test(h, b))
+        {
+            break;
+        }
+        cur += sizeof(BlockHeader) + b->size;
+        if (!(b->flags & BLOCK_FLAG_FREE))
+        {
+            continue;
+        }
+
+        block_reclaim(h, b);
+        uint32_t zeroed = b->flags & BLOCK_FLAG_ZEROED;
+        while (cur + sizeof(BlockHeader) <= end)
+        {
+            BlockHeader *n = (BlockHeader *)(void *)cur;
+            if (!block_start_test(h, n) || !(n->flags & BLOCK_FLAG_FREE))
+            {
+                break;
+            }
+            block_reclaim(h, n);
+            zeroed &= n->flags;
+            size_t step = sizeof(BlockHeader) + n->size;
+            block_start_clear(h, n);
+            // zaglavlje i veza liste postaju deo payload-a
+            memset(n, 0, sizeof(BlockHeader) + sizeof(void *));
+            b->size += step;
+            cur += step;
+        }
+
+        b->flags = BLOCK_FLAG_FREE | zeroed;
+        block_release(h, b);
+        free_list_push(free_list_of(h, b->size), b);
+    }
+}
+
+// ------ TRIM -----------
+size_t heap_trim(Heap *h)
+{
+    if (!h)
+    {
+        return 0;
+    }
+
+    heap_lock(h);
+    size_t before = h->committed_bytes;
+
+    memset(h->free_lists, 0, sizeof(h->free_lists));
+    for (Segment *seg = h->segments; seg; seg = seg->next)
+    {
+        trim_segment(h, seg);
+    }
+    immix_trim(h);
+
+    if (h->pressure_fired && h->committed_bytes < h->soft_limit_bytes - h->soft_limit_bytes / 8)
+    {
+        h->pressure_fired = 0;
+    }
+    size_t released = before > h->committed_bytes ? before - h->committed_bytes : 0;
+    heap_unlock(h);
+
+    return released;
+}
+
+size_t heap_size_bytes(Heap *h)
+{
+    if (!h)
+    {
+        return 0;
+    }
+
+    heap_lock(h);
+    size_t n = h->committed_bytes;
+    heap_unlock(h);
+    return n;
+}
+
+// ------ POVRATNI POZIVI PRITISKA -----------
+int heap_add_pressure_callback(Heap *h, HeapPressureFn fn, void *ctx)
+{
+    if (!h || !fn)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    if (h->pressure_count == h->pressure_cap)
+    {
+        size_t new_cap = (h->pressure_cap == 0) ? 4 : h->pressure_cap * 2;
+        PressureCallback *nc = (PressureCallback *)realloc(h->pressure_cbs, new_cap * sizeof(PressureCallback));
+        if (!nc)
+        {
+            heap_unlock(h);
+            return -1;
+        }
+        h->pressure_cbs = nc;
+        h->pressure_cap = new_cap;
+    }
+    h->pressure_cbs[h->pressure_count].fn = fn;
+    h->pressure_cbs[h->pressure_count].ctx = ctx;
+    h->pressure_count++;
+    heap_unlock(h);
+
+    return 0;
+}
+
+int heap_remove_pressure_callback(Heap *h, HeapPressureFn fn, void *ctx)
+{
+    if (!h)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    for (size_t i = 0; i < h->pressure_count; i++)
+    {
+        if (h->pressure_cbs[i].fn == fn && h->pressure_cbs[i].ctx == ctx)
+        {
+            memmove(&h->pressure_cbs[i], &h->pressure_cbs[i + 1],
+                    (h->pressure_count - i - 1) * sizeof(PressureCallback));
+            h->pressure_count--;
+            heap_unlock(h);
+            return 0;
+        }
+    }
+    heap_unlock(h);
+
+    return -1;
+}
+
+// pod lock-om, posle svakog rasta committed_bytes, i tokom pauze (evakuacija uzima
+// chunkove). Zato samo belezi prelaz meke granice: ciklus trazi alloc_one posle
+// unlock-a ili nit sakupljaca posle ciklusa, a povratni pozivi idu posle ciklusa
+void heap_pressure_check(Heap *h)
+{
+    if (h->soft_limit_bytes && !h->pressure_fired && h->committed_bytes > h->soft_limit_bytes)
+    {
+        h->pressure_fired = 1;
+        atomic_store(&h->pressure_pending, 1);
+        if (!heap_single(h))
+        {
+            atomic_store(&h->pressure_collect, 1);
+        }
+    }
+}
+
+// posle ciklusa koji je pokrenuo prelaz meke granice; pozivi idu van lock-a,
+// pa smeju da oslobadjaju, alociraju i zovu heap_trim
+void heap_pressure_run(Heap *h)
+{
+    if (!atomic_exchange(&h->pressure_pending, 0))
+    {
+        return;
+    }
+
+    heap_lock(h);
+    size_t n = h->pressure_count;
+    PressureCallback *cbs = n ? (PressureCallback *)malloc(n * sizeof(PressureCallback)) : NULL;
+    if (cbs)
+    {
+        memcpy(cbs, h->pressure_cbs, n * sizeof(PressureCallback));
+    }
+    size_t size = h->committed_bytes;
+    heap_unlock(h);
+
+    for (size_t i = 0; cbs && i < n; i++)
+    {
+        cbs[i].fn(h, size, cbs[i].ctx);
+    }
+    free(cbs);
+}
@@ -0,0 +1,251 @@
+#include "heap_state.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+#define EPHEMERON_TOMBSTONE ((void *)(uintptr_t)1)
+
+int weak_add(Heap *h, void **slot)
+{
+    if (!h || !slot)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    int rc = slotset_add(&h->weak, slot);
+    heap_unlock(h);
+
+    region_note_store(h, slot, *slot);
+    return rc;
+}
+
+int weak_remove(Heap *h, void **slot)
+{
+    if (!h || !slot)
+    {
+        return -1;
+    }
+
+    heap_lock(h);
+    int rc = slotset_remove(&h->weak, slot);
+    heap_unlock(h);
+
+    return rc;
+}
+
+// ------ EFEMERON TABELA -----------
+static EphemeronEntry *ephemeron_find(EphemeronTable *t, const void *key)
+{
+    if (t->capacity == 0)
+    {
+        return NULL;
+    }
+
+    size_t mask = t->capacity - 1;
+    size_t i = heap_ptr_hash(key) & mask;
+    while (t->entries[i].key)
+    {
+        if (t->entries[i].key == key)
+        {
+            return &t->entries[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+static int ephemeron_grow(EphemeronTable *t)
+{
+    size_t new_capacity = (t->capacity == 0) ? 16 : t->capacity;
+    if ((t->count + 1) * 2 > new_capacity)
+    {
+        new_capacity *= 2;
+    }
+
+    EphemeronEntry *ne = (EphemeronEntry *)calloc(new_capacity, sizeof(EphemeronEntry));
+    if (!ne)
+    {
+        return -1;
+    }
+
+    size_t mask = new_capacity - 1;
+    for (size_t k = 0; k < t->capacity; k++)
+    {
+        EphemeronEntry *e = &t->entries[k];
+        if (!e->key || e->key == EPHEMERON_TOMBSTONE)
+        {
+            continue;
+        }
+        size_t i = heap_ptr_hash(e->key) & mask;
+        while (ne[i].key)
+        {
+            i = (i + 1) & mask;
+        }
+        ne[i] = *e;
+    }
+
+    free(t->entries);
+    t->entries = ne;
+    t->capacity = new_capacity;
+    t->used = t->count;
+    return 0;
+}
+
+void ephemeron_entry_clear(EphemeronTable *t, EphemeronEntry *e)
+{
+    e->key = EPHEMERON_TOMBSTONE;
+    e->value = NULL;
+    t->count--;
+}
+
+int ephemeron_entry_live(const EphemeronEntry *e)
+{
+    return e->key && e->key != EPHEMERON_TOMBSTONE;
+}
+
+EphemeronTable *ephemeron_create(Heap *h)
+{
+    if (!h)
+    {
+        return NULL;
+    }
+
+    EphemeronTable *t = (EphemeronTable *)calloc(1, sizeof(EphemeronTable));
+    if (!t)
+    {
+        return NULL;
+    }
+    t->heap = h;
+
+    heap_lock(h);
+    t->next = h->ephemerons;
+    h->ephemerons = t;
+    heap_unlock(h);
+
+    return t;
+}
+
+void ephemeron_destroy(EphemeronTable *t)
+{
+    if (!t)
+    {
+        return;
+    }
+
+    Heap *h = t->heap;
+    heap_lock(h);
+    EphemeronTable **pp = &h->ephemerons;
+    while (*pp)
+    {
+        if (*pp == t)
+        {
+            *pp = t->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    heap_unlock(h);
+
+    free(t->entries);
+    free(t);
+}
+
+int ephemeron_put(EphemeronTable *t, void *key, void *value)
+{
+    if (!t || !key || key == EPHEMERON_TOMBSTONE)
+    {
+        return -1;
+    }
+
+    Heap *h = t->heap;
+    region_note_store(h, NULL, key);
+    region_note_store(h, NULL, value);
+    heap_lock(h);
+
+    EphemeronEntry *e = ephemeron_find(t, key);
+    if (e)
+    {
+        e->value = value;
+        heap_unlock(h);
+        return 0;
+    }
+
+    if ((t->used + 1) * 4 > t->capacity * 3)
+    {
+        if (ephemeron_grow(t) != 0)
+        {
+            heap_unlock(h);
+            return -1;
+        }
+    }
+
+    size_t mask = t->capacity - 1;
+    size_t i = heap_ptr_hash(key) & mask;
+    while (ephemeron_entry_live(&t->entries[i]))
+    {
+        i = (i + 1) & mask;
+    }
+
+    if (!t->entries[i].key)
+    {
+        t->used++;
+    }
+    t->entries[i].key = key;
+    t->entries[i].value = value;
+    t->count++;
+
+    heap_unlock(h);
+    return 0;
+}
+
+void *ephemeron_get(EphemeronTable *t, void *key)
+{
+    if (!t || !key)
+    {
+        return NULL;
+    }
+
+    Heap *h = t->heap;
+    heap_lock(h);
+    EphemeronEntry *e = ephemeron_find(t, key);
+    void *value = e ? e->value : NULL;
+    heap_unlock(h);
+
+    return value;
+}
+
+int ephemeron_remove(EphemeronTable *t, void *key)
+{
+    if (!t || !key)
+    {
+        return -1;
+    }
+
+    Heap *h = t->heap;
+    heap_lock(h);
+    EphemeronEntry *e = ephemeron_find(t, key);
+    if (!e)
+    {
+        heap_unlock(h);
+        return -1;
+    }
+    ephemeron_entry_clear(t, e);
+    heap_unlock(h);
+
+    return 0;
+}
+
+size_t ephemeron_count(EphemeronTable *t)
+{
+    if (!t)
+    {
+        return 0;
+    }
+
+    Heap *h = t->heap;
+    heap_lock(h);
+    size_t n = t->count;
+    heap_unlock(h);
+
+    return n;
+}